@@ -5,14 +5,302 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <stdexcept>
+#include <memory_resource>
+#include <optional>
+#include <tuple>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <csignal>
+#include <future>
+#endif
 
 #include <raylib.h>
 #include <nlohmann/json.hpp>
+#include <zlib.h>
 
 extern "C"
 {
 #include "thirdparty/noise/noise1234.h"
+
+// the permutation table of noise1234.c, shared with the specialized kernels
+extern unsigned char perm[];
+}
+
+// ========================================================================
+
+namespace Profiling
+{
+    using Clock = std::chrono::steady_clock;
+
+    // calls of the global operator new, only tracked with WORLDGEN_PROFILING
+    inline std::atomic<uint64_t> globalAllocations{0};
+    inline thread_local int allocationTrackingPaused = 0;
+
+    // the profiler's own bookkeeping is not accounted
+    struct AllocationTrackingPause
+    {
+        AllocationTrackingPause() { allocationTrackingPaused++; }
+        ~AllocationTrackingPause() { allocationTrackingPaused--; }
+    };
+
+    struct Event
+    {
+        std::string name;
+        int64_t startNs;
+        int64_t durationNs;
+        uint32_t thread;
+    };
+
+    struct Stat
+    {
+        int64_t totalNs = 0;
+        int64_t calls = 0;
+    };
+
+    class Profiler
+    {
+    private:
+        static constexpr size_t EVENTS_MAX = 1 << 20;
+
+        mutable std::mutex mutex;
+        Clock::time_point origin = Clock::now();
+        std::vector<Event> events;
+        std::map<std::string, Stat> stats;
+        std::map<std::string, int64_t> counters;
+        std::unordered_map<std::thread::id, uint32_t> threads;
+
+        uint32_t threadIndex()
+        {
+            auto const p = threads.emplace(std::this_thread::get_id(), uint32_t(threads.size()));
+            return p.first->second;
+        }
+
+    public:
+        static Profiler &instance()
+        {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            origin = Clock::now();
+            events.clear();
+            stats.clear();
+            counters.clear();
+        }
+
+        void record(
+            std::string_view const prefix,
+            std::string_view const suffix,
+            Clock::time_point const start,
+            Clock::time_point const end)
+        {
+            using std::chrono::duration_cast;
+            using std::chrono::nanoseconds;
+
+            auto const duration = duration_cast<nanoseconds>(end - start).count();
+
+            AllocationTrackingPause const pause;
+            auto const name = std::string(prefix).append(suffix);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &stat = stats[name];
+            stat.totalNs += duration;
+            stat.calls++;
+
+            // keep the aggregates even when the trace itself is full
+            if (events.size() < EVENTS_MAX)
+                events.push_back({name, duration_cast<nanoseconds>(start - origin).count(), duration, threadIndex()});
+        }
+
+        void count(std::string_view const prefix, std::string_view const suffix, int64_t const value)
+        {
+            AllocationTrackingPause const pause;
+            auto const name = std::string(prefix).append(suffix);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            counters[name] += value;
+        }
+
+        std::map<std::string, Stat> getStats() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return stats;
+        }
+
+        std::map<std::string, int64_t> getCounters() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return counters;
+        }
+
+        // see "Trace Event Format" used by chrome://tracing and Perfetto, timestamps are in microseconds
+        void writeChromeTrace(std::ostream &out) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto trace = nlohmann::json::array();
+            for (auto const &e : events)
+                trace.push_back({{"name", e.name},
+                                 {"ph", "X"},
+                                 {"ts", e.startNs / 1000.0},
+                                 {"dur", e.durationNs / 1000.0},
+                                 {"pid", 1},
+                                 {"tid", e.thread}});
+
+            // counters are reported once at the end of the recorded interval
+            int64_t end = 0;
+            for (auto const &e : events)
+                end = std::max(end, e.startNs + e.durationNs);
+
+            for (auto const &[name, value] : counters)
+                trace.push_back({{"name", name},
+                                 {"ph", "C"},
+                                 {"ts", end / 1000.0},
+                                 {"pid", 1},
+                                 {"tid", 0},
+                                 {"args", {{"value", value}}}});
+
+            out << nlohmann::json{{"traceEvents", trace}, {"displayTimeUnit", "ms"}}.dump();
+        }
+    };
+
+    // the name is prefix + suffix, both have to outlive the timer
+    class ScopedTimer
+    {
+    private:
+        std::string_view prefix;
+        std::string_view suffix;
+        Clock::time_point start;
+
+    public:
+        explicit ScopedTimer(std::string_view const namePrefix, std::string_view const nameSuffix = {})
+            : prefix(namePrefix), suffix(nameSuffix), start(Clock::now()) {}
+
+        ScopedTimer(ScopedTimer const &) = delete;
+        ScopedTimer &operator=(ScopedTimer const &) = delete;
+
+        ~ScopedTimer()
+        {
+            Profiler::instance().record(prefix, suffix, start, Clock::now());
+        }
+    };
+
+    // reports the number of global operator new calls made in the scope as the "global new/<name>" counter
+    class AllocationCounter
+    {
+    private:
+        std::string_view name;
+        uint64_t before;
+
+    public:
+        explicit AllocationCounter(std::string_view const counterName)
+            : name(counterName), before(globalAllocations.load()) {}
+
+        AllocationCounter(AllocationCounter const &) = delete;
+        AllocationCounter &operator=(AllocationCounter const &) = delete;
+
+        ~AllocationCounter()
+        {
+            Profiler::instance().count("global new/", name, int64_t(globalAllocations.load() - before));
+        }
+    };
+}
+
+// compile-time switch, everything below evaporates unless WORLDGEN_PROFILING is defined
+#ifdef WORLDGEN_PROFILING
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(...) Profiling::ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(__VA_ARGS__)
+#define PROFILE_COUNT(name, value) Profiling::Profiler::instance().count(name, {}, value)
+#define PROFILE_COUNT_NAMED(prefix, suffix, value) Profiling::Profiler::instance().count(prefix, suffix, value)
+#define PROFILE_ALLOCATIONS(name) Profiling::AllocationCounter PROFILE_CONCAT(profileAllocations, __LINE__)(name)
+#define PROFILE_RESET() Profiling::Profiler::instance().reset()
+
+void *operator new(std::size_t const size)
+{
+    if (!Profiling::allocationTrackingPaused)
+        Profiling::globalAllocations++;
+
+    if (auto const ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t const size, std::align_val_t const alignment)
+{
+    if (!Profiling::allocationTrackingPaused)
+        Profiling::globalAllocations++;
+
+    auto const align = std::size_t(alignment);
+#ifdef _WIN32
+    auto const ptr = _aligned_malloc(size ? size : 1, align);
+#else
+    auto const ptr = std::aligned_alloc(align, (std::max(size, align) + align - 1) / align * align);
+#endif
+    if (ptr)
+        return ptr;
+    throw std::bad_alloc();
+}
+
+// kept out of line, otherwise GCC pairs the inlined free() with the new expression and warns
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void *const ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *const ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void *const ptr, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+void operator delete(void *const ptr, std::size_t, std::align_val_t const alignment) noexcept
+{
+    operator delete(ptr, alignment);
 }
+#else
+#define PROFILE_SCOPE(...) ((void)0)
+#define PROFILE_COUNT(name, value) ((void)0)
+#define PROFILE_COUNT_NAMED(prefix, suffix, value) ((void)0)
+#define PROFILE_ALLOCATIONS(name) ((void)0)
+#define PROFILE_RESET() ((void)0)
+#endif
 
 // ========================================================================
 
@@ -33,6 +321,9 @@ namespace Configuration
             std::array<int16_t, 2> direction;
             std::string replaceBy;
             std::vector<Target> structures;
+
+            // the structures that can fit at all, StructureProvider::preload() prunes the rest
+            std::vector<Target> candidates;
         };
 
         int32_t cost;
@@ -43,6 +334,18 @@ namespace Configuration
         std::unordered_map<uint16_t, std::string> coordToJoint;
     };
 
+    void indexJoints(Structure &s)
+    {
+        s.coordToJoint.clear();
+        for (auto &[name, joint] : s.joints)
+        {
+            auto const coords = (joint.location[0] << 8) + joint.location[1];
+            s.coordToJoint.emplace(coords, name);
+
+            joint.candidates = joint.structures;
+        }
+    }
+
     void from_json(const nlohmann::json &j, Structure::Target &t)
     {
         j.at("id").get_to(t.structureId);
@@ -74,11 +377,73 @@ namespace Configuration
         }
 
         // post-processing
-        for (auto const [name, joint] : s.joints)
+        indexJoints(s);
+    }
+
+    // structure roots spread over the surface, see res/seeding.json
+    struct Seeding
+    {
+        struct Root
         {
-            auto const coords = (joint.location[0] << 8) + joint.location[1];
-            s.coordToJoint.emplace(coords, name);
-        }
+            std::string structureId;
+            std::string joint;
+            float density;  // expected roots per surface column
+            int minSpacing; // to any other root, in tiles
+            int depth;      // of the joint below the surface
+        };
+
+        std::vector<Root> roots;
+    };
+
+    void from_json(const nlohmann::json &j, Seeding::Root &r)
+    {
+        j.at("id").get_to(r.structureId);
+        j.at("joint").get_to(r.joint);
+        j.at("density").get_to(r.density);
+        j.at("min-spacing").get_to(r.minSpacing);
+        r.depth = j.value("depth", 2);
+    }
+
+    void from_json(const nlohmann::json &j, Seeding &s)
+    {
+        j.at("roots").get_to(s.roots);
+    }
+
+    // generation stages, see res/pipeline.json
+    struct Pipeline
+    {
+        struct Stage
+        {
+            std::string name;
+            std::string type;
+
+            // layers like "tiles" or "rng", stages without conflicting layers run in parallel
+            std::vector<std::string> reads;
+            std::vector<std::string> writes;
+
+            // split into column bands that run in parallel
+            bool chunked;
+
+            // specific to the stage type
+            nlohmann::json parameters;
+        };
+
+        std::vector<Stage> stages;
+    };
+
+    void from_json(const nlohmann::json &j, Pipeline::Stage &s)
+    {
+        j.at("name").get_to(s.name);
+        j.at("type").get_to(s.type);
+        s.reads = j.value("reads", std::vector<std::string>());
+        s.writes = j.value("writes", std::vector<std::string>());
+        s.chunked = j.value("chunked", false);
+        s.parameters = j.value("parameters", nlohmann::json::object());
+    }
+
+    void from_json(const nlohmann::json &j, Pipeline &p)
+    {
+        j.at("stages").get_to(p.stages);
     }
 }
 
@@ -99,12 +464,22 @@ constexpr TileId STRUCTURE_JOINT = 129;
 
 constexpr TileId UNKNOWN = 255;
 
+// a cell has a tile on every layer, the visible one is the foreground tile unless it is AIR
+enum class Layer
+{
+    FOREGROUND, // terrain and the solid structure parts
+    BACKGROUND, // behind the foreground, e.g. the inside of the rooms
+};
+
 class TileRegistry
 {
 private:
     std::unordered_map<TileId, Color> colors;
     std::unordered_map<std::string, TileId> names;
 
+    // looked up for every structure cell, hence a table
+    std::array<Layer, 256> layers{};
+
 public:
     TileId getTile(std::string const &name) const
     {
@@ -122,11 +497,17 @@ public:
             return RED;
     }
 
-    void registerTile(TileId const tile, std::string const &name, Color color)
+    Layer getTileLayer(TileId const tile) const
+    {
+        return layers[tile];
+    }
+
+    void registerTile(TileId const tile, std::string const &name, Color color, Layer const layer = Layer::FOREGROUND)
     {
         color.a = 255;
         names[name] = tile;
         colors[tile] = color;
+        layers[tile] = layer;
     }
 };
 
@@ -138,26 +519,100 @@ constexpr int WORLD_WIDTH_M1 = WORLD_WIDTH - 1;
 constexpr int WORLD_HEIGHT = 350;
 constexpr int WORLD_HEIGHT_M1 = WORLD_HEIGHT - 1;
 
+// a read-only rectangle of the world, its rows go bottom to top and are `stride` tiles apart
+struct TileView
+{
+    TileId const *data;
+    int width;
+    int height;
+    int stride;
+
+    TileId const *row(int const y) const
+    {
+        return data + y * stride;
+    }
+};
+
 class World
 {
 private:
-    TileId tiles[WORLD_WIDTH * WORLD_HEIGHT] = {0};
+    // every layer is a plane of its own, rows go bottom to top
+    TileId foreground[WORLD_WIDTH * WORLD_HEIGHT] = {0};
+    TileId background[WORLD_WIDTH * WORLD_HEIGHT] = {0};
+    uint16_t owners[WORLD_WIDTH * WORLD_HEIGHT] = {0}; // 1 + index of the placement, 0 - terrain
+    uint8_t light[WORLD_WIDTH * WORLD_HEIGHT] = {0};   // [0; LIGHT_MAX]
+
+    // the highest cell with a tile on any layer
     uint16_t heightMap[WORLD_WIDTH] = {0};
 
+    TileId *plane(Layer const layer)
+    {
+        return layer == Layer::FOREGROUND ? foreground : background;
+    }
+
+    TileId const *plane(Layer const layer) const
+    {
+        return layer == Layer::FOREGROUND ? foreground : background;
+    }
+
+    bool isEmpty(int const index) const
+    {
+        return foreground[index] == AIR && background[index] == AIR;
+    }
+
+    // clips the rectangle to the world, the offset of the clipped origin goes to `dx` and `dy`
+    static bool clipRegion(int &x, int &y, int &width, int &height, int &dx, int &dy)
+    {
+        dx = std::max(0, -x);
+        dy = std::max(0, -y);
+        x += dx;
+        y += dy;
+        width = std::min(width - dx, WORLD_WIDTH - x);
+        height = std::min(height - dy, WORLD_HEIGHT - y);
+        return width > 0 && height > 0;
+    }
+
+    // the heights of the columns [minX; maxX) after the rows [minY; maxY) were written
+    void updateHeights(int const minX, int const maxX, int const minY, int const maxY)
+    {
+        for (int x = minX; x < maxX; x++)
+        {
+            auto &height = heightMap[x];
+            if (height >= maxY)
+                continue;
+
+            auto top = maxY - 1;
+            while (top >= minY && isEmpty(x + top * WORLD_WIDTH))
+                --top;
+
+            if (top >= minY)
+                height = top;
+            else if (height >= minY)
+            {
+                height = minY > 0 ? minY - 1 : 0;
+                while (height > 0 && isEmpty(x + height * WORLD_WIDTH))
+                    --height;
+            }
+        }
+    }
+
 public:
-    void setTile(int x, int y, TileId tile)
+    static constexpr uint8_t LIGHT_MAX = 15;
+
+    void setTile(int x, int y, TileId tile, Layer const layer = Layer::FOREGROUND)
     {
         if (x < 0 || x > WORLD_WIDTH_M1 ||
             y < 0 || y > WORLD_HEIGHT_M1)
             return;
 
-        tiles[x + y * WORLD_WIDTH] = tile;
+        auto const index = x + y * WORLD_WIDTH;
+        plane(layer)[index] = tile;
         auto &height = heightMap[x];
 
-        if (tile == AIR)
+        if (isEmpty(index))
         {
             if (y == height)
-                while (height > 0 && tiles[x + height * WORLD_WIDTH] == AIR)
+                while (height > 0 && isEmpty(x + height * WORLD_WIDTH))
                     --height;
         }
         else
@@ -167,116 +622,705 @@ public:
         }
     }
 
+    // the visible tile
     TileId getTileAt(int x, int y) const
     {
         if (x < 0 || x > WORLD_WIDTH_M1 ||
             y < 0 || y > WORLD_HEIGHT_M1)
             return AIR;
 
-        return tiles[x + y * WORLD_WIDTH];
+        auto const index = x + y * WORLD_WIDTH;
+        return foreground[index] != AIR ? foreground[index] : background[index];
     }
 
-    int getHeightAt(int const x) const
+    TileId getTileAt(int x, int y, Layer const layer) const
     {
-        if (x < 0 || x > WORLD_WIDTH_M1)
-            return 0;
-        else
-            return heightMap[x];
+        if (x < 0 || x > WORLD_WIDTH_M1 ||
+            y < 0 || y > WORLD_HEIGHT_M1)
+            return AIR;
+
+        return plane(layer)[x + y * WORLD_WIDTH];
     }
 
-    void clear()
+    // a row of a single layer, readRegion() composes the visible tiles
+    TileId const *getRow(int const y, Layer const layer = Layer::FOREGROUND) const
     {
-        std::fill(std::begin(tiles), std::end(tiles), AIR);
-        std::fill(std::begin(heightMap), std::end(heightMap), 0);
+        // no bounds checks here: the row is expected to be in [0; WORLD_HEIGHT)
+        return plane(layer) + y * WORLD_WIDTH;
     }
 
-    void render(Image *const img, TileRegistry const *const registry) const
+    void setOwner(int x, int y, uint16_t const owner)
     {
-        auto tilePtr = tiles + WORLD_HEIGHT_M1 * WORLD_WIDTH;
-        auto pixel = (Color *)img->data;
+        if (x < 0 || x > WORLD_WIDTH_M1 ||
+            y < 0 || y > WORLD_HEIGHT_M1)
+            return;
 
-        for (int y = 0; y < WORLD_HEIGHT; y++, tilePtr -= WORLD_WIDTH * 2)
-            for (int x = 0; x < WORLD_WIDTH; x++, tilePtr++, pixel++)
-                *pixel = registry->getTileColor(*tilePtr);
+        owners[x + y * WORLD_WIDTH] = owner;
     }
-};
 
-// ========================================================================
-
-struct StructureObject
-{
-    int width;
-    int height;
+    int getOwnerAt(int x, int y) const
+    {
+        if (x < 0 || x > WORLD_WIDTH_M1 ||
+            y < 0 || y > WORLD_HEIGHT_M1)
+            return 0;
 
-    Configuration::Structure config;
+        return owners[x + y * WORLD_WIDTH];
+    }
 
-    std::vector<TileId> tiles;
-};
+    void setLight(int x, int y, uint8_t const level)
+    {
+        if (x < 0 || x > WORLD_WIDTH_M1 ||
+            y < 0 || y > WORLD_HEIGHT_M1)
+            return;
 
-class StructureProvider
-{
-private:
-    std::unordered_map<std::string, std::unique_ptr<StructureObject>> loadedStructures;
-    TileRegistry const *tileRegistry = nullptr;
+        light[x + y * WORLD_WIDTH] = level;
+    }
 
-    StructureObject const *loadStructure(std::string const &id)
+    // outside of the world is the open sky
+    int getLightAt(int x, int y) const
     {
-        auto p = loadedStructures.emplace(id, std::make_unique<StructureObject>());
-        auto result = p.first->second.get();
+        if (x < 0 || x > WORLD_WIDTH_M1 ||
+            y < 0 || y > WORLD_HEIGHT_M1)
+            return LIGHT_MAX;
 
-        // load the configuration
-        std::ifstream in("../../res/" + id + ".json");
-        result->config = nlohmann::json::parse(in).get<Configuration::Structure>();
+        return light[x + y * WORLD_WIDTH];
+    }
 
-        // load image
-        auto img = LoadImage(("../../res/" + id + ".png").c_str());
-        result->width = img.width;
-        result->height = img.height;
+    // a row of the light plane, no bounds checks either
+    uint8_t *getLightRow(int const y)
+    {
+        return light + y * WORLD_WIDTH;
+    }
 
-        // change orientation before-hand for ease of use
-        ImageFlipVertical(&img);
-        ImageFormat(&img, PixelFormat::UNCOMPRESSED_R8G8B8A8);
-        // convert to tiles
+    uint8_t const *getLightRow(int const y) const
+    {
+        return light + y * WORLD_WIDTH;
+    }
 
-        result->tiles = std::vector<TileId>(img.width * img.height);
+    int getHeightAt(int const x) const
+    {
+        if (x < 0 || x > WORLD_WIDTH_M1)
+            return 0;
+        else
+            return heightMap[x];
+    }
 
-        auto pixel = (Color const *)img.data;
-        auto tile = result->tiles.data();
-        auto const tileLast = tile + img.width * img.height;
-        for (; tile != tileLast; pixel++, tile++)
+    // the heights of the columns [x; x + count), 0 outside of the world
+    void getHeights(int const x, int const count, int *const heights) const
+    {
+        int dx, dy, clippedX = x, y = 0, width = count, height = 1;
+        if (!clipRegion(clippedX, y, width, height, dx, dy))
         {
-            auto const color = (pixel->r << 16) + (pixel->g << 8) + pixel->b;
-            auto const name = result->config.colorsToBlocks[color];
-            *tile = tileRegistry->getTile(name);
+            std::fill(heights, heights + std::max(count, 0), 0);
+            return;
         }
 
-        UnloadImage(img);
-
-        return result;
+        std::fill(heights, heights + dx, 0);
+        std::copy(heightMap + clippedX, heightMap + clippedX + width, heights + dx);
+        std::fill(heights + dx + width, heights + count, 0);
     }
 
-public:
-    void attachTileRegistry(TileRegistry const *const registry)
+    // a view of a single layer without a copy, the region must lie inside the world
+    TileView getRegion(int const x, int const y, int const width, int const height, Layer const layer = Layer::FOREGROUND) const
     {
-        this->tileRegistry = registry;
+        if (x < 0 || y < 0 || width < 0 || height < 0 ||
+            x + width > WORLD_WIDTH || y + height > WORLD_HEIGHT)
+            throw std::out_of_range("region " + std::to_string(width) + "x" + std::to_string(height) + " at (" +
+                                    std::to_string(x) + ", " + std::to_string(y) + ") is outside of the world");
+
+        return {plane(layer) + x + y * WORLD_WIDTH, width, height, WORLD_WIDTH};
     }
 
-    StructureObject const *getStructure(std::string const &id)
+    // copies the visible tiles of a rectangle into `dst` (rows `stride` tiles apart), the cells outside of the world are AIR
+    void readRegion(int x, int y, int width, int height, TileId *const dst, int const stride) const
     {
-        if (auto const iter = loadedStructures.find(id); iter != loadedStructures.end())
-            return iter->second.get();
-        else
-            return loadStructure(id);
+        for (int row = 0; row < height; row++)
+            std::fill(dst + row * stride, dst + row * stride + width, AIR);
+
+        int dx, dy;
+        if (!clipRegion(x, y, width, height, dx, dy))
+            return;
+
+        for (int row = 0; row < height; row++)
+        {
+            auto const offset = x + (y + row) * WORLD_WIDTH;
+            auto const fg = foreground + offset;
+            auto const bg = background + offset;
+            auto const out = dst + dx + (dy + row) * stride;
+
+            for (int i = 0; i < width; i++)
+                out[i] = fg[i] != AIR ? fg[i] : bg[i];
+        }
     }
-};
 
-// ========================================================================
+    // the writes are clipped to the world like setTile, the height map is updated once per region
+    void fillRegion(int x, int y, int width, int height, TileId const tile, Layer const layer = Layer::FOREGROUND)
+    {
+        int dx, dy;
+        if (!clipRegion(x, y, width, height, dx, dy))
+            return;
 
-using StructurePlacementChecker = bool (*)(World const *world, int x, int y, StructureObject const *obj);
+        auto const tiles = plane(layer);
+        for (int row = y; row < y + height; row++)
+            std::fill(tiles + x + row * WORLD_WIDTH, tiles + x + width + row * WORLD_WIDTH, tile);
 
-static bool undergroundPlacementChecker(
-    World const *world,
-    int x,
+        updateHeights(x, x + width, y, y + height);
+    }
+
+    void writeRegion(int x, int y, int width, int height, TileId const *const src, int const stride, Layer const layer = Layer::FOREGROUND)
+    {
+        int dx, dy;
+        if (!clipRegion(x, y, width, height, dx, dy))
+            return;
+
+        auto const tiles = plane(layer);
+        for (int row = 0; row < height; row++)
+        {
+            auto const from = src + dx + (dy + row) * stride;
+            std::copy(from, from + width, tiles + x + (y + row) * WORLD_WIDTH);
+        }
+
+        updateHeights(x, x + width, y, y + height);
+    }
+
+    // every layer of the rectangle from another world, the heights of its columns as well,
+    // so the rest of these columns is expected to match `source` already
+    void copyRegion(World const &source, int x, int y, int width, int height)
+    {
+        int dx, dy;
+        if (!clipRegion(x, y, width, height, dx, dy))
+            return;
+
+        for (int row = y; row < y + height; row++)
+        {
+            auto const begin = x + row * WORLD_WIDTH;
+            std::copy_n(source.foreground + begin, width, foreground + begin);
+            std::copy_n(source.background + begin, width, background + begin);
+            std::copy_n(source.owners + begin, width, owners + begin);
+            std::copy_n(source.light + begin, width, light + begin);
+        }
+
+        std::copy_n(source.heightMap + x, width, heightMap + x);
+    }
+
+    void clear()
+    {
+        std::fill(std::begin(foreground), std::end(foreground), AIR);
+        std::fill(std::begin(background), std::end(background), AIR);
+        std::fill(std::begin(owners), std::end(owners), 0);
+        std::fill(std::begin(light), std::end(light), 0);
+        std::fill(std::begin(heightMap), std::end(heightMap), 0);
+    }
+
+    void render(Image *const img, TileRegistry const *const registry) const
+    {
+        renderRows(img, registry, 0, WORLD_HEIGHT);
+    }
+
+    // renders the visible tiles of the world rows [fromY; toY), the image is top-down
+    void renderRows(Image *const img, TileRegistry const *const registry, int const fromY, int const toY) const
+    {
+        for (int y = fromY; y < toY; y++)
+        {
+            auto fg = foreground + y * WORLD_WIDTH;
+            auto bg = background + y * WORLD_WIDTH;
+            auto pixel = (Color *)img->data + (WORLD_HEIGHT_M1 - y) * WORLD_WIDTH;
+
+            for (int x = 0; x < WORLD_WIDTH; x++, fg++, bg++, pixel++)
+                *pixel = registry->getTileColor(*fg != AIR ? *fg : *bg);
+        }
+    }
+};
+
+// shared between a generation running on a worker thread and its observer
+struct GenerationProgress
+{
+    std::atomic<bool> cancelled{false};
+
+    // optional, the generator copies the terrain rows into it as soon as they are done;
+    // the observer reads the rows below getPreviewRows(), nothing writes them afterwards
+    World *preview = nullptr;
+
+    // the rows copied into the preview, per column since bands of columns are generated concurrently
+    std::atomic<int> previewRows[WORLD_WIDTH] = {};
+
+    void reset()
+    {
+        cancelled = false;
+        for (auto &rows : previewRows)
+            rows.store(0, std::memory_order_relaxed);
+    }
+
+    // the rows [fromY; toY) of the columns [fromX; toX) of `world` are final terrain
+    void publishRows(World const *const world, int const fromX, int const toX, int const fromY, int const toY)
+    {
+        if (!preview)
+            return;
+
+        preview->copyRegion(*world, fromX, fromY, toX - fromX, toY - fromY);
+        for (int x = fromX; x < toX; x++)
+            previewRows[x].store(toY, std::memory_order_release);
+    }
+
+    int getPreviewRows() const
+    {
+        auto rows = WORLD_HEIGHT;
+        for (auto const &columnRows : previewRows)
+            rows = std::min(rows, columnRows.load(std::memory_order_acquire));
+        return rows;
+    }
+
+    bool isCancelled() const
+    {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+};
+
+// ========================================================================
+
+struct StructureObject
+{
+    std::string id;
+
+    int width;
+    int height;
+
+    Configuration::Structure config;
+
+    // identical grids (e.g. symmetric pieces and their mirrors) share the storage
+    std::shared_ptr<std::vector<TileId> const> tiles;
+
+    // the joint candidates have been checked against this structure
+    bool pruned = false;
+};
+
+// transformations applied to a base structure on load, in image coordinates (y goes down)
+enum class StructureTransform
+{
+    ROTATE_90, // clockwise
+    ROTATE_180,
+    ROTATE_270,
+    MIRROR_X,
+    MIRROR_Y,
+};
+
+static bool parseStructureTransform(std::string const &name, StructureTransform &transform)
+{
+    static std::unordered_map<std::string, StructureTransform> const transforms = {
+        {"rotate-90", StructureTransform::ROTATE_90},
+        {"rotate-180", StructureTransform::ROTATE_180},
+        {"rotate-270", StructureTransform::ROTATE_270},
+        {"mirror-x", StructureTransform::MIRROR_X},
+        {"mirror-y", StructureTransform::MIRROR_Y},
+    };
+
+    if (auto const iter = transforms.find(name); iter != transforms.cend())
+    {
+        transform = iter->second;
+        return true;
+    }
+    else
+        return false;
+}
+
+class StructureProvider
+{
+private:
+    std::unordered_map<std::string, std::unique_ptr<StructureObject>> loadedStructures;
+    TileRegistry const *tileRegistry = nullptr;
+
+    struct SharedGrid
+    {
+        int width;
+        std::shared_ptr<std::vector<TileId> const> tiles;
+    };
+
+    // content hash -> grids with that hash
+    std::unordered_multimap<size_t, SharedGrid> tileGrids;
+
+    std::shared_ptr<std::vector<TileId> const> deduplicate(int const width, std::vector<TileId> &&tiles)
+    {
+        auto const bytes = std::string_view((char const *)tiles.data(), tiles.size() * sizeof(TileId));
+        auto const hash = std::hash<std::string_view>{}(bytes) ^ size_t(width);
+
+        auto const range = tileGrids.equal_range(hash);
+        for (auto iter = range.first; iter != range.second; ++iter)
+            if (iter->second.width == width && *iter->second.tiles == tiles)
+                return iter->second.tiles;
+
+        auto shared = std::make_shared<std::vector<TileId> const>(std::move(tiles));
+        tileGrids.emplace(hash, SharedGrid{width, shared});
+        return shared;
+    }
+
+    struct PaletteEntry
+    {
+        uint32_t color; // 0xRRGGBB
+        TileId tile;
+    };
+
+    // the color to tile mapping of a structure, the tile names are looked up once per structure
+    std::vector<PaletteEntry> resolvePalette(std::string const &id, Configuration::Structure const &config) const
+    {
+        std::vector<PaletteEntry> palette;
+        palette.reserve(config.colorsToBlocks.size());
+
+        for (auto const &[color, name] : config.colorsToBlocks)
+        {
+            auto const tile = tileRegistry->getTile(name);
+            if (tile == UNKNOWN)
+                throw std::runtime_error(id + ": unknown tile '" + name + "'");
+
+            palette.push_back({color, tile});
+        }
+
+        return palette;
+    }
+
+    // returns the index of the first pixel without a palette entry, `count` when all are mapped
+    static size_t pixelsToTiles(
+        Color const *const pixels,
+        size_t const count,
+        std::vector<PaletteEntry> const &palette,
+        TileId *const tiles)
+    {
+        // pack the pixels into 0xRRGGBB keys first, that loop has no branches and vectorizes
+        std::vector<uint32_t> keys(count);
+        auto const bytes = (uint8_t const *)pixels;
+        for (size_t i = 0; i < count; i++)
+            keys[i] = (uint32_t(bytes[i * 4]) << 16) | (uint32_t(bytes[i * 4 + 1]) << 8) | bytes[i * 4 + 2];
+
+        // the palettes have a handful of entries and the images are mostly runs of the same color
+        auto lastKey = ~uint32_t(0);
+        auto lastTile = UNKNOWN;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            auto const key = keys[i];
+            if (key != lastKey)
+            {
+                auto const entry = std::find_if(
+                    palette.cbegin(), palette.cend(),
+                    [key](PaletteEntry const &e) { return e.color == key; });
+                if (entry == palette.cend())
+                    return i;
+
+                lastKey = key;
+                lastTile = entry->tile;
+            }
+
+            tiles[i] = lastTile;
+        }
+
+        return count;
+    }
+
+    // produces a rotated or mirrored copy of the structure, joints are moved and re-directed accordingly
+    static void transformStructure(StructureObject *const obj, std::vector<TileId> &tiles, StructureTransform const transform)
+    {
+        auto const w = obj->width;
+        auto const h = obj->height;
+        auto const swapped = transform == StructureTransform::ROTATE_90 || transform == StructureTransform::ROTATE_270;
+        auto const newW = swapped ? h : w;
+        auto const newH = swapped ? w : h;
+
+        // image coordinates to the transformed image coordinates
+        auto const map = [&](int const x, int const y) -> std::array<int, 2>
+        {
+            switch (transform)
+            {
+            case StructureTransform::ROTATE_90:
+                return {h - 1 - y, x};
+            case StructureTransform::ROTATE_180:
+                return {w - 1 - x, h - 1 - y};
+            case StructureTransform::ROTATE_270:
+                return {y, w - 1 - x};
+            case StructureTransform::MIRROR_X:
+                return {w - 1 - x, y};
+            case StructureTransform::MIRROR_Y:
+            default:
+                return {x, h - 1 - y};
+            }
+        };
+
+        // directions use world coordinates (y goes up)
+        auto const mapDirection = [&](int const dx, int const dy) -> std::array<int, 2>
+        {
+            switch (transform)
+            {
+            case StructureTransform::ROTATE_90:
+                return {dy, -dx};
+            case StructureTransform::ROTATE_180:
+                return {-dx, -dy};
+            case StructureTransform::ROTATE_270:
+                return {-dy, dx};
+            case StructureTransform::MIRROR_X:
+                return {-dx, dy};
+            case StructureTransform::MIRROR_Y:
+            default:
+                return {dx, -dy};
+            }
+        };
+
+        // tiles are stored bottom to top
+        std::vector<TileId> transformed(tiles.size());
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+            {
+                auto const [nx, ny] = map(x, y);
+                transformed[nx + (newH - 1 - ny) * newW] = tiles[x + (h - 1 - y) * w];
+            }
+
+        for (auto &[_, joint] : obj->config.joints)
+        {
+            auto const [nx, ny] = map(joint.location[0], joint.location[1]);
+            auto const [dx, dy] = mapDirection(joint.direction[0], joint.direction[1]);
+            joint.location = {uint16_t(nx), uint16_t(ny)};
+            joint.direction = {int16_t(dx), int16_t(dy)};
+        }
+
+        obj->width = newW;
+        obj->height = newH;
+        tiles = std::move(transformed);
+    }
+
+    // a derived structure: {"base": "<id>", "transform": "rotate-90" or [...], "rename-joints": {"#old": "#new"}}
+    void loadDerivedStructure(StructureObject *const result, nlohmann::json const &description)
+    {
+        auto const base = getStructure(description.at("base").get<std::string>());
+        result->width = base->width;
+        result->height = base->height;
+        result->config = base->config;
+        auto tiles = *base->tiles;
+
+        auto transforms = description.value("transform", nlohmann::json::array());
+        if (transforms.is_string())
+            transforms = nlohmann::json::array({transforms});
+
+        for (auto const &name : transforms)
+        {
+            StructureTransform transform;
+            if (!parseStructureTransform(name.get<std::string>(), transform))
+                throw std::runtime_error(result->id + ": unknown transform '" + name.get<std::string>() + "'");
+
+            transformStructure(result, tiles, transform);
+        }
+
+        if (auto const iter = description.find("rename-joints"); iter != description.end())
+        {
+            auto &joints = result->config.joints;
+            decltype(result->config.joints) renamed;
+
+            for (auto &[name, joint] : joints)
+                renamed.emplace(iter->value(name, name), std::move(joint));
+
+            joints = std::move(renamed);
+        }
+
+        Configuration::indexJoints(result->config);
+        result->tiles = deduplicate(result->width, std::move(tiles));
+    }
+
+    StructureObject const *loadStructure(std::string const &id)
+    {
+        PROFILE_SCOPE("StructureProvider::loadStructure");
+
+        // only cached once it is complete, a structure that fails to load is not left half-built
+        auto structure = std::make_unique<StructureObject>();
+        auto const result = structure.get();
+        result->id = id;
+
+        // load the configuration
+        std::ifstream in("../../res/" + id + ".json");
+        auto const description = nlohmann::json::parse(in);
+
+        // rotations and mirrors of other pieces have no image of their own
+        if (description.contains("base"))
+        {
+            loadDerivedStructure(result, description);
+            return loadedStructures.emplace(id, std::move(structure)).first->second.get();
+        }
+
+        result->config = description.get<Configuration::Structure>();
+
+        // before the image is loaded, it would leak when this throws
+        auto const palette = resolvePalette(id, result->config);
+
+        // load image
+        auto img = LoadImage(("../../res/" + id + ".png").c_str());
+        result->width = img.width;
+        result->height = img.height;
+
+        // change orientation before-hand for ease of use
+        ImageFlipVertical(&img);
+        ImageFormat(&img, PixelFormat::UNCOMPRESSED_R8G8B8A8);
+
+        // convert to tiles
+        auto tiles = std::vector<TileId>(img.width * img.height);
+
+        auto const unmapped = pixelsToTiles((Color const *)img.data, tiles.size(), palette, tiles.data());
+        if (unmapped != tiles.size())
+        {
+            auto const pixel = ((Color const *)img.data)[unmapped];
+            UnloadImage(img);
+
+            char color[8];
+            std::snprintf(color, sizeof(color), "#%02x%02x%02x", pixel.r, pixel.g, pixel.b);
+            throw std::runtime_error(
+                id + ": unmapped color " + color + " at (" +
+                std::to_string(unmapped % result->width) + ", " +
+                std::to_string(result->height - 1 - int(unmapped / result->width)) + ")");
+        }
+
+        UnloadImage(img);
+
+        result->tiles = deduplicate(img.width, std::move(tiles));
+
+        return loadedStructures.emplace(id, std::move(structure)).first->second.get();
+    }
+
+    // whether the parts of `target` attached to `parentJoint` through `targetJoint` overlap the parts of `parent`
+    static bool overlaps(
+        StructureObject const *const parent,
+        Configuration::Structure::Joint const &parentJoint,
+        StructureObject const *const target,
+        Configuration::Structure::Joint const &targetJoint)
+    {
+        // the origin of the target relative to the parent, y goes up like in the world
+        auto const dx = parentJoint.direction[0] + parentJoint.location[0] - targetJoint.location[0];
+        auto const dy = parentJoint.direction[1] + (parent->height - 1 - parentJoint.location[1]) -
+                        (target->height - 1 - targetJoint.location[1]);
+
+        auto const &targetTiles = *target->tiles;
+        auto const &parentTiles = *parent->tiles;
+
+        // only the intersection of both rectangles, in target coordinates
+        for (int y = std::max(0, -dy); y < std::min(target->height, parent->height - dy); y++)
+            for (int x = std::max(0, -dx); x < std::min(target->width, parent->width - dx); x++)
+                if (targetTiles[x + y * target->width] != STRUCTURE_VOID &&
+                    parentTiles[x + dx + (y + dy) * parent->width] != STRUCTURE_VOID)
+                    return true;
+
+        return false;
+    }
+
+    // drops the candidates that always overlap their parent: the parent's space is claimed before
+    // its joints propagate, so can_be_build() would reject every attempt. the targets must be loaded
+    void pruneJoints(StructureObject *const obj)
+    {
+        for (auto &[name, joint] : obj->config.joints)
+        {
+            joint.candidates.clear();
+
+            for (auto const &target : joint.structures)
+            {
+                auto const targetObj = loadedStructures.at(target.structureId).get();
+                auto const targetJoint = targetObj->config.joints.find(target.joint);
+                auto const attachment = obj->id + " " + name + " -> " + target.structureId + " " + target.joint;
+
+                if (targetJoint == targetObj->config.joints.cend())
+                    warnings.push_back(attachment + ": no such joint");
+                else if (overlaps(obj, joint, targetObj, targetJoint->second))
+                    warnings.push_back(attachment + ": always overlaps " + obj->id + ", pruned");
+                else
+                    joint.candidates.push_back(target);
+            }
+        }
+
+        obj->pruned = true;
+    }
+
+    // roots preload() has been called for
+    std::unordered_set<std::string> preloaded;
+
+    std::vector<std::string> warnings;
+
+public:
+    void attachTileRegistry(TileRegistry const *const registry)
+    {
+        this->tileRegistry = registry;
+    }
+
+    StructureObject const *getStructure(std::string const &id)
+    {
+        if (auto const iter = loadedStructures.find(id); iter != loadedStructures.end())
+            return iter->second.get();
+        else
+            return loadStructure(id);
+    }
+
+    // a structure that does not come from res/, e.g. a generated one; `tiles` go bottom to top
+    StructureObject const *registerStructure(
+        std::string const &id,
+        int const width,
+        int const height,
+        Configuration::Structure config,
+        std::vector<TileId> tiles)
+    {
+        if (tiles.size() != size_t(width) * height)
+            throw std::runtime_error(id + ": " + std::to_string(tiles.size()) + " tiles for " +
+                                     std::to_string(width) + "x" + std::to_string(height));
+
+        auto &slot = loadedStructures[id];
+        if (slot)
+            throw std::runtime_error(id + ": already registered");
+
+        slot = std::make_unique<StructureObject>();
+        slot->id = id;
+        slot->width = width;
+        slot->height = height;
+        slot->config = std::move(config);
+        Configuration::indexJoints(slot->config);
+        slot->tiles = deduplicate(width, std::move(tiles));
+        return slot.get();
+    }
+
+    // loads the structure and everything reachable over its joints and prunes their joint candidates,
+    // afterwards getStructure() for those does not modify the provider and may be called concurrently
+    void preload(std::string const &id)
+    {
+        if (preloaded.count(id))
+            return;
+
+        std::vector<std::string> pending = {id};
+        std::vector<std::string> reached = {id};
+        std::unordered_set<std::string> seen = {id};
+
+        while (!pending.empty())
+        {
+            auto const obj = getStructure(pending.back());
+            pending.pop_back();
+
+            for (auto const &[_, joint] : obj->config.joints)
+                for (auto const &target : joint.structures)
+                    if (seen.insert(target.structureId).second)
+                    {
+                        pending.push_back(target.structureId);
+                        reached.push_back(target.structureId);
+                    }
+        }
+
+        for (auto const &reachedId : reached)
+            if (auto const obj = loadedStructures.at(reachedId).get(); !obj->pruned)
+                pruneJoints(obj);
+
+        preloaded.insert(id);
+    }
+
+    // asset problems found by preload()
+    std::vector<std::string> const &getWarnings() const
+    {
+        return warnings;
+    }
+};
+
+// ========================================================================
+
+using StructurePlacementChecker = bool (*)(World const *world, int x, int y, StructureObject const *obj);
+
+static bool undergroundPlacementChecker(
+    World const *world,
+    int x,
     int y,
     StructureObject const *obj)
 {
@@ -303,326 +1347,5155 @@ static bool noBlocksPlacementChecker(
 
 // ========================================================================
 
-constexpr int COST_MAX = 8;
-
-class StructureBuilder
+// Monotonic arena for the per-generation data: allocation is a pointer bump, deallocation is a no-op
+// and everything is dropped at once by reset(). When a generation overflows the initial buffer,
+// the buffer grows to the observed peak, so subsequent generations stay off the global heap.
+class GenerationArena
 {
 private:
-    World *world = nullptr;
-    StructureProvider *structureProvider = nullptr;
-    TileRegistry const *tileRegistry = nullptr;
+    class Upstream : public std::pmr::memory_resource
+    {
+    public:
+        size_t bytes = 0;
+        size_t calls = 0;
 
-    bool obstructed[WORLD_WIDTH * WORLD_HEIGHT] = {0};
+    private:
+        void *do_allocate(size_t const size, size_t const alignment) override
+        {
+            bytes += size;
+            calls++;
+            return std::pmr::new_delete_resource()->allocate(size, alignment);
+        }
 
-    void claimStructureSpace(
-        int const callerX,
-        int const callerY,
-        StructureObject const *const obj)
+        void do_deallocate(void *const ptr, size_t const size, size_t const alignment) override
+        {
+            std::pmr::new_delete_resource()->deallocate(ptr, size, alignment);
+        }
+
+        bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    std::vector<std::byte> buffer;
+    Upstream upstream;
+    std::optional<std::pmr::monotonic_buffer_resource> resource;
+
+public:
+    explicit GenerationArena(size_t const initialSize) : buffer(initialSize)
+    {
+        resource.emplace(buffer.data(), buffer.size(), &upstream);
+    }
+
+    GenerationArena(GenerationArena const &) = delete;
+    GenerationArena &operator=(GenerationArena const &) = delete;
+
+    std::pmr::memory_resource *get()
+    {
+        return &*resource;
+    }
+
+    // everything allocated from the arena has to be destroyed before
+    void reset()
+    {
+        resource.reset();
+
+        if (upstream.bytes > 0)
+            buffer = std::vector<std::byte>(buffer.size() + upstream.bytes);
+
+        upstream.bytes = 0;
+        upstream.calls = 0;
+        resource.emplace(buffer.data(), buffer.size(), &upstream);
+    }
+
+    size_t getCapacity() const
+    {
+        return buffer.size();
+    }
+
+    // number of allocations since the last reset that did not fit into the buffer
+    size_t getOverflows() const
+    {
+        return upstream.calls;
+    }
+
+    // bytes held since the last reset, the buffer and the overflows
+    size_t getFootprint() const
+    {
+        return buffer.size() + upstream.bytes;
+    }
+};
+
+// ========================================================================
+
+// broad phase for placed structures: bounding boxes bucketed into a uniform grid
+class StructureIndex
+{
+public:
+    struct Box
+    {
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
+private:
+    static constexpr int CELL_SIZE = 32;
+    static constexpr int COLUMNS = (WORLD_WIDTH + CELL_SIZE - 1) / CELL_SIZE;
+    static constexpr int ROWS = (WORLD_HEIGHT + CELL_SIZE - 1) / CELL_SIZE;
+
+    std::pmr::vector<Box> boxes;
+    std::pmr::vector<std::pmr::vector<uint32_t>> cells;
+
+    static int toCell(int const value, int const limit)
+    {
+        return std::clamp(value / CELL_SIZE, 0, limit - 1);
+    }
+
+    template <typename Callback>
+    void forEachCell(int const x0, int const y0, int const x1, int const y1, Callback &&callback) const
+    {
+        for (int cy = toCell(y0, ROWS); cy <= toCell(y1, ROWS); cy++)
+            for (int cx = toCell(x0, COLUMNS); cx <= toCell(x1, COLUMNS); cx++)
+                if (!callback(cells[cx + cy * COLUMNS]))
+                    return;
+    }
+
+    static bool overlaps(Box const &a, Box const &b)
+    {
+        return a.x < b.x + b.width && b.x < a.x + a.width &&
+               a.y < b.y + b.height && b.y < a.y + a.height;
+    }
+
+public:
+    explicit StructureIndex(std::pmr::memory_resource *const resource = std::pmr::get_default_resource())
+        : boxes(resource), cells(COLUMNS * ROWS, resource) {}
+
+    void clear()
+    {
+        boxes.clear();
+        for (auto &cell : cells)
+            cell.clear();
+    }
+
+    uint32_t insert(Box const &box)
+    {
+        auto const id = uint32_t(boxes.size());
+        boxes.push_back(box);
+
+        for (int cy = toCell(box.y, ROWS); cy <= toCell(box.y + box.height - 1, ROWS); cy++)
+            for (int cx = toCell(box.x, COLUMNS); cx <= toCell(box.x + box.width - 1, COLUMNS); cx++)
+                cells[cx + cy * COLUMNS].push_back(id);
+
+        return id;
+    }
+
+    bool overlapsAny(Box const &box) const
+    {
+        auto found = false;
+        forEachCell(box.x, box.y, box.x + box.width - 1, box.y + box.height - 1, [&](auto const &cell)
+                    {
+                        for (auto const id : cell)
+                            if (overlaps(boxes[id], box))
+                            {
+                                found = true;
+                                break;
+                            }
+                        return !found; });
+
+        return found;
+    }
+
+    // ids of all boxes that are not farther than `radius` from the point, in the order of insertion;
+    // only reads the index, so concurrent queries are safe
+    std::vector<uint32_t> queryRadius(int const x, int const y, int const radius) const
+    {
+        std::vector<uint32_t> result;
+
+        forEachCell(x - radius, y - radius, x + radius, y + radius, [&](auto const &cell)
+                    {
+                        for (auto const id : cell)
+                        {
+                            // distance from the point to the nearest point of the box
+                            auto const &b = boxes[id];
+                            auto const dx = std::max({b.x - x, 0, x - (b.x + b.width - 1)});
+                            auto const dy = std::max({b.y - y, 0, y - (b.y + b.height - 1)});
+                            if (dx * dx + dy * dy <= radius * radius)
+                                result.push_back(id);
+                        }
+                        return true; });
+
+        // boxes spanning several cells are found once per cell
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    Box const &getBox(uint32_t const id) const
+    {
+        return boxes[id];
+    }
+
+    size_t size() const
+    {
+        return boxes.size();
+    }
+};
+
+// ========================================================================
+
+// connected complexes of placed structures: a union-find over the placements,
+// every complex keeps the number of its pieces and their bounding box at its root
+class StructureComplexes
+{
+public:
+    using Box = StructureIndex::Box;
+
+private:
+    // path halving in find() changes the parents only
+    mutable std::pmr::vector<uint32_t> parents;
+    std::pmr::vector<uint32_t> sizes;
+    std::pmr::vector<Box> bounds;
+    size_t count = 0;
+
+public:
+    explicit StructureComplexes(std::pmr::memory_resource *const resource = std::pmr::get_default_resource())
+        : parents(resource), sizes(resource), bounds(resource) {}
+
+    // a new complex of a single piece, ids follow the placements
+    uint32_t add(Box const &box)
+    {
+        auto const id = uint32_t(parents.size());
+        parents.push_back(id);
+        sizes.push_back(1);
+        bounds.push_back(box);
+        count++;
+        return id;
+    }
+
+    uint32_t find(uint32_t id) const
+    {
+        while (parents[id] != id)
+            id = parents[id] = parents[parents[id]];
+        return id;
+    }
+
+    // false when both are in the same complex already
+    bool unite(uint32_t a, uint32_t b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a == b)
+            return false;
+
+        // the smaller complex goes under the larger one
+        if (sizes[a] < sizes[b])
+            std::swap(a, b);
+
+        auto &box = bounds[a];
+        auto const &other = bounds[b];
+        auto const maxX = std::max(box.x + box.width, other.x + other.width);
+        auto const maxY = std::max(box.y + box.height, other.y + other.height);
+        box.x = std::min(box.x, other.x);
+        box.y = std::min(box.y, other.y);
+        box.width = maxX - box.x;
+        box.height = maxY - box.y;
+
+        parents[b] = a;
+        sizes[a] += sizes[b];
+        count--;
+        return true;
+    }
+
+    // number of the complexes
+    size_t getCount() const
+    {
+        return count;
+    }
+
+    // of the complex `id` belongs to
+    size_t getPieceCount(uint32_t const id) const
+    {
+        return sizes[find(id)];
+    }
+
+    Box const &getBounds(uint32_t const id) const
+    {
+        return bounds[find(id)];
+    }
+
+    // the root of every complex once, in ascending order
+    std::vector<uint32_t> getRoots() const
+    {
+        std::vector<uint32_t> roots;
+        for (uint32_t id = 0; id < parents.size(); id++)
+            if (parents[id] == id)
+                roots.push_back(id);
+        return roots;
+    }
+
+    size_t size() const
+    {
+        return parents.size();
+    }
+};
+
+// ========================================================================
+
+constexpr int COST_MAX = 8;
+
+class StructureBuilder
+{
+    friend class BenchmarkSuite;
+
+private:
+    World *world = nullptr;
+    StructureProvider *structureProvider = nullptr;
+    TileRegistry const *tileRegistry = nullptr;
+    GenerationProgress const *progress = nullptr;
+
+    bool obstructed[WORLD_WIDTH * WORLD_HEIGHT] = {0};
+
+    struct BuildRequest
+    {
+        int x;
+        int y;
+        StructureObject const *obj;
+        int cost;
+        size_t placement;          // index into the placements
+        std::string const *entry;  // the joint it is attached by
+    };
+
+public:
+    struct Placement
+    {
+        int x;
+        int y;
+        StructureObject const *obj;
+        int cost;
+    };
+
+    // a joint with target structures that nothing got attached to
+    struct DanglingJoint
+    {
+        uint32_t placement;
+        std::string const *joint;
+        int x;
+        int y;
+    };
+
+private:
+    // everything that lives for a single generation, allocated from the arena
+    struct Transients
+    {
+        std::pmr::deque<BuildRequest> buildQueue;
+
+        // every accepted request in the order of acceptance
+        std::pmr::vector<Placement> placements;
+
+        // bounding boxes of the claimed structures, indexed the same way as `placements`
+        StructureIndex placedIndex;
+
+        // the placements joined through their joints, indexed the same way as well
+        StructureComplexes complexes;
+        std::pmr::vector<DanglingJoint> dangling;
+
+        // scratch pool of propagate()
+        std::pmr::vector<Configuration::Structure::Target const *> targets;
+
+        explicit Transients(std::pmr::memory_resource *const resource)
+            : buildQueue(resource), placements(resource), placedIndex(resource),
+              complexes(resource), dangling(resource), targets(resource) {}
+    };
+
+    GenerationArena arena{1 << 16};
+    std::optional<Transients> transients{arena.get()};
+
+    // columns [regionMinX; regionMaxX) the structures have to stay in
+    int regionMinX = 0;
+    int regionMaxX = WORLD_WIDTH;
+
+    // of a branch, summed over its pieces
+    int costLimit = COST_MAX;
+
+    void claimStructureSpace(
+        int const callerX,
+        int const callerY,
+        StructureObject const *const obj)
+    {
+        auto tilePtr = obj->tiles->data();
+        auto obstruction = obstructed + callerX + callerY * WORLD_WIDTH;
+
+        for (int y = 0; y < obj->height; y++, obstruction += WORLD_WIDTH - obj->width)
+            for (int x = 0; x < obj->width; x++, tilePtr++, obstruction++)
+                // is it an actual structure part?
+                if (*tilePtr != STRUCTURE_VOID)
+                    *obstruction = true;
+    }
+
+    bool can_be_build(
+        int const callerX,
+        int const callerY,
+        StructureObject const *const obj) const
+    {
+        PROFILE_SCOPE("StructureBuilder::can_be_build");
+
+        if (callerX < 0 || callerX + obj->width > WORLD_WIDTH_M1 ||
+            callerY < 0 || callerY + obj->height > WORLD_HEIGHT_M1)
+        {
+            PROFILE_COUNT("rejected/bounds", 1);
+            return false;
+        }
+
+        if (callerX < regionMinX || callerX + obj->width > regionMaxX)
+        {
+            PROFILE_COUNT("rejected/region", 1);
+            return false;
+        }
+
+        // nothing has been placed around, no need to look at the cells
+        if (!transients->placedIndex.overlapsAny({callerX, callerY, obj->width, obj->height}))
+            return true;
+
+        auto tilePtr = obj->tiles->data();
+        auto obstruction = obstructed + callerX + callerY * WORLD_WIDTH;
+
+        for (int y = 0; y < obj->height; y++, obstruction += WORLD_WIDTH - obj->width)
+            for (int x = 0; x < obj->width; x++, tilePtr++, obstruction++)
+                // is this part already occupied by some other structure?
+                if (*tilePtr != STRUCTURE_VOID && *obstruction)
+                {
+                    PROFILE_COUNT("rejected/obstructed", 1);
+                    return false;
+                }
+
+        return true;
+    }
+
+    std::mt19937 rng;
+
+    // records the placement as the owner of its cells
+    void assignOwner(
+        int const callerX,
+        int const callerY,
+        StructureObject const *const obj,
+        size_t const placement)
+    {
+        auto const owner = uint16_t(std::min<size_t>(placement + 1, UINT16_MAX));
+        auto tilePtr = obj->tiles->data();
+
+        for (int y = 0; y < obj->height; y++)
+            for (int x = 0; x < obj->width; x++, tilePtr++)
+                if (*tilePtr != STRUCTURE_VOID)
+                    world->setOwner(callerX + x, callerY + y, owner);
+    }
+
+    void build(
+        int const callerX,
+        int const callerY,
+        StructureObject const *const obj,
+        size_t const placement)
+    {
+        PROFILE_SCOPE("StructureBuilder::build");
+
+        auto tilePtr = obj->tiles->data();
+        [[maybe_unused]] int64_t cellsWritten = 0;
+
+        // materialize the structure
+        for (int y = 0; y < obj->height; y++)
+        {
+            for (int x = 0; x < obj->width; x++, tilePtr++)
+            {
+                TileId tile;
+
+                // is it an actual structure part?
+                switch (*tilePtr)
+                {
+                case STRUCTURE_VOID:
+                    // just ignore it
+                    continue;
+
+                case STRUCTURE_JOINT:
+                {
+                    // place replacement tile instead
+                    auto const cIndex = (x << 8) + (obj->height - 1 - y);
+                    auto const &jointName = obj->config.coordToJoint.at(cIndex);
+                    auto const &joint = obj->config.joints.at(jointName);
+
+                    tile = tileRegistry->getTile(joint.replaceBy);
+                    break;
+                }
+
+                default:
+                    tile = *tilePtr;
+                    break;
+                }
+
+                // the structure replaces the terrain: background parts clear the foreground, air clears both
+                if (tileRegistry->getTileLayer(tile) == Layer::BACKGROUND)
+                {
+                    world->setTile(callerX + x, callerY + y, tile, Layer::BACKGROUND);
+                    world->setTile(callerX + x, callerY + y, AIR);
+                }
+                else
+                {
+                    world->setTile(callerX + x, callerY + y, tile);
+                    if (tile == AIR)
+                        world->setTile(callerX + x, callerY + y, AIR, Layer::BACKGROUND);
+                }
+                cellsWritten++;
+            }
+        }
+
+        assignOwner(callerX, callerY, obj, placement);
+
+        PROFILE_COUNT("cells written", cellsWritten);
+    }
+
+    void propagate(BuildRequest const &request)
+    {
+        PROFILE_SCOPE("StructureBuilder::propagate");
+
+        auto const callerX = request.x;
+        auto const callerY = request.y;
+        auto const obj = request.obj;
+        auto const cost = request.cost;
+        auto &targets = transients->targets;
+
+        for (auto const &[name, joint] : obj->config.joints)
+        {
+            // the joint it hangs on does not dangle, pruned joints do
+            if (joint.candidates.empty())
+            {
+                if (!joint.structures.empty() && &name != request.entry)
+                    addDangling(request.placement, name, joint);
+                continue;
+            }
+
+            // queue the following structure (structure-specific alignment will be done separately)
+            auto const newX = callerX + joint.direction[0] + joint.location[0];
+            auto const newY = callerY + joint.direction[1] + (obj->height - 1 - joint.location[1]);
+
+            // prepare the pool of target structures
+            targets.clear();
+            uint32_t totalWeight = 0;
+            for (auto const &target : joint.candidates)
+            {
+                targets.emplace_back(&target);
+                totalWeight += target.weight;
+            }
+
+            // enqueue the random placeable target
+            auto attached = false;
+            while (!targets.empty())
+            {
+                Configuration::Structure::Target const *target = nullptr;
+
+                if (totalWeight == 0 || targets.size() == 1)
+                {
+                    // pick the only thing left
+                    target = *targets.begin();
+                    targets.clear();
+                }
+                else
+                {
+                    // pick a random value
+                    auto const value = rng() % totalWeight;
+
+                    // find anything that is above the threshold
+                    uint32_t weightSum = 0;
+                    for (auto it = targets.cbegin(); it != targets.cend(); it++)
+                    {
+                        auto const candidate = *it;
+                        weightSum += candidate->weight;
+
+                        if (weightSum > value)
+                        {
+                            target = candidate;
+
+                            // remove the selected thing from the pool unrelated to placement successfulness
+                            targets.erase(it);
+                            totalWeight -= target->weight;
+
+                            break;
+                        }
+                    }
+                }
+
+                // attempt to place the thing, it joins the complex of its parent
+                if (requestStructureAt(newX, newY, target->structureId, target->joint, cost))
+                {
+                    transients->complexes.unite(
+                        uint32_t(request.placement), uint32_t(transients->placements.size() - 1));
+                    attached = true;
+                    break;
+                }
+            }
+
+            if (!attached && &name != request.entry)
+                addDangling(request.placement, name, joint);
+        }
+    }
+
+    void addDangling(size_t const placement, std::string const &name, Configuration::Structure::Joint const &joint)
+    {
+        auto const &p = transients->placements[placement];
+        transients->dangling.push_back(
+            {uint32_t(placement), &name,
+             p.x + joint.location[0], p.y + (p.obj->height - 1 - joint.location[1])});
+    }
+
+    std::unordered_map<std::string, StructurePlacementChecker> placementCheckers;
+
+public:
+    StructureBuilder()
+    {
+        this->placementCheckers.emplace("underground", undergroundPlacementChecker);
+        this->placementCheckers.emplace("no-blocks", noBlocksPlacementChecker);
+    }
+
+    void attachWorld(World *const worldPtr)
+    {
+        this->world = worldPtr;
+    }
+
+    void registerPlacementChecker(std::string const &name, StructurePlacementChecker const checker)
+    {
+        this->placementCheckers[name] = checker;
+    }
+
+    void attachStructureProvider(StructureProvider *const provider)
+    {
+        this->structureProvider = provider;
+    }
+
+    void attachTileRegistry(TileRegistry const *registry)
+    {
+        this->tileRegistry = registry;
+    }
+
+    // optional, the queue stops draining once the generation is cancelled
+    void attachProgress(GenerationProgress const *const generationProgress)
+    {
+        this->progress = generationProgress;
+    }
+
+    void reset()
+    {
+        std::fill(std::begin(obstructed), std::end(obstructed), false);
+
+        // drop the previous generation all at once
+        transients.reset();
+        arena.reset();
+        transients.emplace(arena.get());
+
+        setRegion(0, WORLD_WIDTH);
+    }
+
+    void seed(uint32_t const value)
+    {
+        rng.seed(value);
+    }
+
+    // structures placed from now on must fit into the columns [minX; maxX)
+    void setRegion(int const minX, int const maxX)
+    {
+        regionMinX = minX;
+        regionMaxX = maxX;
+    }
+
+    void setCostLimit(int const limit)
+    {
+        costLimit = limit;
+    }
+
+    // takes over placements [first; last) of another builder working on the same world
+    void absorb(StructureBuilder const &other, size_t const first, size_t const last)
+    {
+        auto const offset = transients->placements.size() - first;
+
+        for (auto i = first; i < last; i++)
+        {
+            auto const &placement = other.transients->placements[i];
+
+            claimStructureSpace(placement.x, placement.y, placement.obj);
+            assignOwner(placement.x, placement.y, placement.obj, transients->placements.size());
+            transients->placements.push_back(placement);
+            transients->placedIndex.insert({placement.x, placement.y, placement.obj->width, placement.obj->height});
+            transients->complexes.add({placement.x, placement.y, placement.obj->width, placement.obj->height});
+        }
+
+        // the complexes of the range stay within it
+        for (auto i = first; i < last; i++)
+            if (auto const root = other.transients->complexes.find(uint32_t(i)); root >= first && root < last)
+                transients->complexes.unite(uint32_t(i + offset), uint32_t(root + offset));
+
+        for (auto const &dangling : other.transients->dangling)
+            if (dangling.placement >= first && dangling.placement < last)
+                transients->dangling.push_back({uint32_t(dangling.placement + offset), dangling.joint, dangling.x, dangling.y});
+    }
+
+    std::pmr::vector<Placement> const &getPlacements() const
+    {
+        return transients->placements;
+    }
+
+    // ids are the indices into getPlacements()
+    StructureComplexes const &getComplexes() const
+    {
+        return transients->complexes;
+    }
+
+    // in the order the joints were given up on
+    std::pmr::vector<DanglingJoint> const &getDanglingJoints() const
+    {
+        return transients->dangling;
+    }
+
+    // indices into getPlacements() of the structures within `radius` tiles of the point
+    std::vector<uint32_t> getPlacementsWithin(int const x, int const y, int const radius) const
+    {
+        return transients->placedIndex.queryRadius(x, y, radius);
+    }
+
+    GenerationArena const &getArena() const
+    {
+        return arena;
+    }
+
+    bool requestStructureAt(
+        int x,
+        int y,
+        std::string const &structureId,
+        std::string const &targetJoint,
+        int cost)
+    {
+        PROFILE_COUNT("attempts", 1);
+
+        // find the structure and correct the origin point
+        auto const obj = structureProvider->getStructure(structureId);
+        auto const entry = obj->config.joints.find(targetJoint);
+        if (entry == obj->config.joints.end())
+            throw std::out_of_range("no joint " + targetJoint + " in " + structureId);
+
+        auto const &joint = entry->second;
+        x -= joint.location[0];
+        y -= obj->height - 1 - joint.location[1];
+
+        // correct the cost of current building branch
+        cost += obj->config.cost;
+        if (cost > costLimit)
+        {
+            PROFILE_COUNT("rejected/cost", 1);
+            return false;
+        }
+
+        // see if there is enougth space
+        if (!can_be_build(x, y, obj))
+            return false;
+
+        // check placement constraints
+        for (auto const &constraint : obj->config.placementConstraints)
+        {
+            PROFILE_SCOPE("placement/", constraint);
+
+            if (auto const &checker = placementCheckers.at(constraint); !checker(world, x, y, obj))
+            {
+                PROFILE_COUNT_NAMED("rejected/", constraint, 1);
+                return false;
+            }
+        }
+
+        // queue and claim space for it
+        transients->buildQueue.push_back({x, y, obj, cost, transients->placements.size(), &entry->first});
+        transients->placements.push_back({x, y, obj, cost});
+        transients->placedIndex.insert({x, y, obj->width, obj->height});
+        transients->complexes.add({x, y, obj->width, obj->height});
+        claimStructureSpace(x, y, obj);
+        PROFILE_COUNT("pieces placed", 1);
+
+        return true;
+    }
+
+    void processAllRequests()
+    {
+        PROFILE_SCOPE("StructureBuilder::processAllRequests");
+        PROFILE_ALLOCATIONS("StructureBuilder::processAllRequests");
+
+        processRequestsUntil(std::chrono::steady_clock::time_point::max());
+    }
+
+    // drains the queue until it is empty (returns true) or the deadline has passed,
+    // at least one request is processed per call
+    bool processRequestsUntil(std::chrono::steady_clock::time_point const deadline)
+    {
+        auto &buildQueue = transients->buildQueue;
+        auto first = true;
+
+        while (!buildQueue.empty())
+        {
+            if (progress && progress->isCancelled())
+                break;
+
+            if (!first && std::chrono::steady_clock::now() >= deadline)
+                return false;
+            first = false;
+
+            auto const request = buildQueue.front();
+            buildQueue.pop_front();
+
+            // materialize the thing and propagate ongoing structures further after its joints
+            build(request.x, request.y, request.obj, request.placement);
+            propagate(request);
+        }
+
+        PROFILE_COUNT("arena/overflows", int64_t(arena.getOverflows()));
+        return true;
+    }
+};
+
+// ========================================================================
+
+// scores of a finished layout, the higher the better
+using LayoutMetric = double (*)(StructureBuilder const &builder);
+
+static double piecesLayoutMetric(StructureBuilder const &builder)
+{
+    return double(builder.getPlacements().size());
+}
+
+// the costliest branch
+static double depthLayoutMetric(StructureBuilder const &builder)
+{
+    auto depth = 0;
+    for (auto const &placement : builder.getPlacements())
+        depth = std::max(depth, placement.cost);
+    return depth;
+}
+
+// the area of the complexes' bounding boxes
+static double coverageLayoutMetric(StructureBuilder const &builder)
+{
+    auto const &complexes = builder.getComplexes();
+
+    double area = 0;
+    for (auto const root : complexes.getRoots())
+    {
+        auto const &box = complexes.getBounds(root);
+        area += double(box.width) * box.height;
+    }
+    return area;
+}
+
+// the fewer open ends the better
+static double danglingLayoutMetric(StructureBuilder const &builder)
+{
+    return -double(builder.getDanglingJoints().size());
+}
+
+// ========================================================================
+
+// Specialized versions of noise3() for the cases where only x varies along a run of samples.
+// Everything derived from the fixed y and z coordinates (lattice cells, fractional parts, fade
+// weights and the partial hashes) is computed once per slice, the arithmetic on the remaining
+// values is kept in the exact order of noise1234.c so the results are bit-identical.
+namespace Noise
+{
+    // same rounding as noise1234.c, including the off-by-one for exact integers
+    inline int fastFloor(float const x)
+    {
+        return (int)x < x ? (int)x : (int)x - 1;
+    }
+
+    inline float fade(float const t)
+    {
+        return t * t * t * (t * (t * 6 - 15) + 10);
+    }
+
+    inline float lerp(float const t, float const a, float const b)
+    {
+        return a + t * (b - a);
+    }
+
+    // grad3() of noise1234.c as a table: which coordinate is "u"/"v" (0 - x, 1 - y, 2 - z) and their signs
+    struct Gradient
+    {
+        uint8_t u;
+        uint8_t v;
+        float uSign;
+        float vSign;
+    };
+
+    constexpr Gradient makeGradient(int const h)
+    {
+        return {uint8_t(h < 8 ? 0 : 1),
+                uint8_t(h < 4 ? 1 : (h == 12 || h == 14) ? 0 : 2),
+                (h & 1) ? -1.f : 1.f,
+                (h & 2) ? -1.f : 1.f};
+    }
+
+    constexpr Gradient GRADIENTS[16] = {
+        makeGradient(0), makeGradient(1), makeGradient(2), makeGradient(3),
+        makeGradient(4), makeGradient(5), makeGradient(6), makeGradient(7),
+        makeGradient(8), makeGradient(9), makeGradient(10), makeGradient(11),
+        makeGradient(12), makeGradient(13), makeGradient(14), makeGradient(15),
+    };
+
+    inline float grad3(int const hash, float const x, float const y, float const z)
+    {
+        auto const &g = GRADIENTS[hash & 15];
+        float const c[3] = {x, y, z};
+
+        // multiplying by +-1 is exact, so this matches the branchy original
+        return g.uSign * c[g.u] + g.vSign * c[g.v];
+    }
+
+    class Slice
+    {
+    private:
+        int hash00, hash01, hash10, hash11; // perm[iy + perm[iz]] for (y0, z0), (y0, z1), (y1, z0), (y1, z1)
+        float fy0, fy1, fz0, fz1;
+        float t, r;
+
+    public:
+        Slice() = default;
+
+        Slice(float const y, float const z)
+        {
+            auto iy0 = fastFloor(y);
+            auto iz0 = fastFloor(z);
+            fy0 = y - iy0;
+            fz0 = z - iz0;
+            fy1 = fy0 - 1.0f;
+            fz1 = fz0 - 1.0f;
+            auto const iy1 = (iy0 + 1) & 0xff;
+            auto const iz1 = (iz0 + 1) & 0xff;
+            iy0 = iy0 & 0xff;
+            iz0 = iz0 & 0xff;
+
+            r = fade(fz0);
+            t = fade(fy0);
+
+            hash00 = perm[iy0 + perm[iz0]];
+            hash01 = perm[iy0 + perm[iz1]];
+            hash10 = perm[iy1 + perm[iz0]];
+            hash11 = perm[iy1 + perm[iz1]];
+        }
+
+        // equals noise3(x, y, z)
+        float operator()(float const x) const
+        {
+            auto ix0 = fastFloor(x);
+            auto const fx0 = x - ix0;
+            auto const fx1 = fx0 - 1.0f;
+            auto const ix1 = (ix0 + 1) & 0xff;
+            ix0 = ix0 & 0xff;
+
+            auto const s = fade(fx0);
+
+            auto nxy0 = grad3(perm[ix0 + hash00], fx0, fy0, fz0);
+            auto nxy1 = grad3(perm[ix0 + hash01], fx0, fy0, fz1);
+            auto nx0 = lerp(r, nxy0, nxy1);
+
+            nxy0 = grad3(perm[ix0 + hash10], fx0, fy1, fz0);
+            nxy1 = grad3(perm[ix0 + hash11], fx0, fy1, fz1);
+            auto nx1 = lerp(r, nxy0, nxy1);
+
+            auto const n0 = lerp(t, nx0, nx1);
+
+            nxy0 = grad3(perm[ix1 + hash00], fx1, fy0, fz0);
+            nxy1 = grad3(perm[ix1 + hash01], fx1, fy0, fz1);
+            nx0 = lerp(r, nxy0, nxy1);
+
+            nxy0 = grad3(perm[ix1 + hash10], fx1, fy1, fz0);
+            nxy1 = grad3(perm[ix1 + hash11], fx1, fy1, fz1);
+            nx1 = lerp(r, nxy0, nxy1);
+
+            auto const n1 = lerp(t, nx0, nx1);
+
+            return 0.936f * (lerp(s, n0, n1));
+        }
+    };
+
+    // equals WorldGenerator::fractalNoise(OCTAVES, x, y, z)
+    template <int OCTAVES>
+    class Fractal
+    {
+    private:
+        Slice slices[OCTAVES];
+        float scales[OCTAVES];
+        float frequencies[OCTAVES];
+
+    public:
+        Fractal(float const y, float const z)
+        {
+            auto scale = 1.0f;
+            auto k = 0.5f;
+
+            for (int i = 0; i < OCTAVES; i++)
+            {
+                scale *= 0.5f;
+                k *= 2.f;
+
+                scales[i] = scale;
+                frequencies[i] = k;
+                slices[i] = Slice(y * k, z * k);
+            }
+        }
+
+        float operator()(float const x) const
+        {
+            auto result = 0.f;
+
+            // the trip count is a compile-time constant, so the loop gets unrolled
+            for (int i = 0; i < OCTAVES; i++)
+                result += scales[i] * (slices[i](x * frequencies[i]) + 1.0f) * 0.5f;
+
+            return result;
+        }
+    };
+
+    // noise3() in Q16.16 fixed point with the same lattice, permutation and gradients. Only integer
+    // arithmetic is used, so the results are identical on every compiler and with any floating point
+    // flags; they stay within about 30 Q16 units (5e-4) of noise3(). Negative values are shifted right
+    // arithmetically, which every supported compiler does (and C++20 requires).
+    namespace Fixed
+    {
+        constexpr int SHIFT = 16;
+        constexpr int64_t ONE = int64_t(1) << SHIFT;
+
+        // exact for the dyadic coordinates of the generator (x / 32.f and alike)
+        inline int64_t fromFloat(float const value)
+        {
+            return int64_t(std::floor(double(value) * double(ONE)));
+        }
+
+        inline float toFloat(int64_t const value)
+        {
+            return float(value) / float(ONE);
+        }
+
+        // the lattice cell (masked) and the offset in it, an exact integer belongs to the cell below like in fastFloor()
+        inline void split(int64_t const coordinate, int &cell, int64_t &offset)
+        {
+            offset = coordinate & (ONE - 1);
+            cell = int(coordinate >> SHIFT);
+            if (offset == 0)
+            {
+                cell -= 1;
+                offset = ONE;
+            }
+            cell &= 0xff;
+        }
+
+        inline int64_t fade(int64_t const t)
+        {
+            auto const t3 = (((t * t) >> SHIFT) * t) >> SHIFT;
+            auto const inner = ((t * (6 * t - 15 * ONE)) >> SHIFT) + 10 * ONE;
+            return (t3 * inner) >> SHIFT;
+        }
+
+        inline int64_t lerp(int64_t const t, int64_t const a, int64_t const b)
+        {
+            return a + ((t * (b - a)) >> SHIFT);
+        }
+
+        inline int64_t grad3(int const hash, int64_t const x, int64_t const y, int64_t const z)
+        {
+            auto const &g = GRADIENTS[hash & 15];
+            int64_t const c[3] = {x, y, z};
+            return (g.uSign < 0 ? -c[g.u] : c[g.u]) + (g.vSign < 0 ? -c[g.v] : c[g.v]);
+        }
+
+        class Slice
+        {
+        private:
+            int hash00, hash01, hash10, hash11;
+            int64_t fy0, fy1, fz0, fz1;
+            int64_t t, r;
+
+        public:
+            Slice() = default;
+
+            Slice(int64_t const y, int64_t const z)
+            {
+                int iy0, iz0;
+                split(y, iy0, fy0);
+                split(z, iz0, fz0);
+                fy1 = fy0 - ONE;
+                fz1 = fz0 - ONE;
+                auto const iy1 = (iy0 + 1) & 0xff;
+                auto const iz1 = (iz0 + 1) & 0xff;
+
+                r = fade(fz0);
+                t = fade(fy0);
+
+                hash00 = perm[iy0 + perm[iz0]];
+                hash01 = perm[iy0 + perm[iz1]];
+                hash10 = perm[iy1 + perm[iz0]];
+                hash11 = perm[iy1 + perm[iz1]];
+            }
+
+            // noise3(x, y, z) in Q16
+            int64_t operator()(int64_t const x) const
+            {
+                int ix0;
+                int64_t fx0;
+                split(x, ix0, fx0);
+                auto const fx1 = fx0 - ONE;
+                auto const ix1 = (ix0 + 1) & 0xff;
+
+                auto const s = fade(fx0);
+
+                auto const n0 = lerp(t,
+                                     lerp(r, grad3(perm[ix0 + hash00], fx0, fy0, fz0), grad3(perm[ix0 + hash01], fx0, fy0, fz1)),
+                                     lerp(r, grad3(perm[ix0 + hash10], fx0, fy1, fz0), grad3(perm[ix0 + hash11], fx0, fy1, fz1)));
+                auto const n1 = lerp(t,
+                                     lerp(r, grad3(perm[ix1 + hash00], fx1, fy0, fz0), grad3(perm[ix1 + hash01], fx1, fy0, fz1)),
+                                     lerp(r, grad3(perm[ix1 + hash10], fx1, fy1, fz0), grad3(perm[ix1 + hash11], fx1, fy1, fz1)));
+
+                // 0.936 in Q16
+                return (lerp(s, n0, n1) * 61342) >> SHIFT;
+            }
+        };
+
+        // Noise::Fractal in Q16, the octave frequencies are exact powers of two
+        template <int OCTAVES>
+        class Fractal
+        {
+        private:
+            Slice slices[OCTAVES];
+
+        public:
+            Fractal(int64_t const y, int64_t const z)
+            {
+                for (int i = 0; i < OCTAVES; i++)
+                    slices[i] = Slice(y * (int64_t(1) << i), z * (int64_t(1) << i));
+            }
+
+            int64_t operator()(int64_t const x) const
+            {
+                int64_t result = 0;
+
+                // scale * (n + 1) / 2 with scale = 2^-(i + 1)
+                for (int i = 0; i < OCTAVES; i++)
+                    result += (slices[i](x * (int64_t(1) << i)) + ONE) >> (i + 2);
+
+                return result;
+            }
+        };
+    }
+}
+
+// the float noise follows noise1234.c, the fixed-point one is the same on every build
+enum class NoiseMode
+{
+    FLOAT,
+    FIXED,
+};
+
+#ifdef WORLDGEN_FIXED_NOISE
+constexpr NoiseMode DEFAULT_NOISE_MODE = NoiseMode::FIXED;
+#else
+constexpr NoiseMode DEFAULT_NOISE_MODE = NoiseMode::FLOAT;
+#endif
+
+static bool parseNoiseMode(std::string const &name, NoiseMode &mode)
+{
+    static std::unordered_map<std::string, NoiseMode> const modes = {
+        {"float", NoiseMode::FLOAT},
+        {"fixed", NoiseMode::FIXED},
+    };
+
+    if (auto const iter = modes.find(name); iter != modes.cend())
+    {
+        mode = iter->second;
+        return true;
+    }
+    else
+        return false;
+}
+
+// ========================================================================
+
+// cellular automata over bit planes, 64 cells per word
+namespace Automaton
+{
+    constexpr int WORDS = (WORLD_WIDTH + 63) / 64;
+
+    // the bits past WORLD_WIDTH in the last word of a row, they are kept set
+    constexpr uint64_t PADDING = WORLD_WIDTH % 64 ? ~uint64_t(0) << (WORLD_WIDTH % 64) : 0;
+
+    // one bit per cell, rows bottom to top like in World
+    class BitPlane
+    {
+    private:
+        std::vector<uint64_t> words = std::vector<uint64_t>(WORDS * WORLD_HEIGHT);
+
+    public:
+        uint64_t *row(int const y)
+        {
+            return words.data() + y * WORDS;
+        }
+
+        uint64_t const *row(int const y) const
+        {
+            return words.data() + y * WORDS;
+        }
+    };
+
+    // a cell is born with at least `birth` live neighbours and survives with at least `survival`
+    struct Rule
+    {
+        int birth;
+        int survival;
+    };
+
+    // the cells whose neighbour count, given as 4 bit planes, is at least k
+    inline uint64_t atLeast(uint64_t const c0, uint64_t const c1, uint64_t const c2, uint64_t const c3, int const k)
+    {
+        uint64_t result = 0;
+        for (int v = std::max(k, 0); v <= 8; v++)
+            result |= (v & 1 ? c0 : ~c0) & (v & 2 ? c1 : ~c1) & (v & 4 ? c2 : ~c2) & (v & 8 ? c3 : ~c3);
+        return result;
+    }
+
+    // one generation of the rows [fromY; toY), the cells outside of the world count as alive
+    void step(BitPlane const &src, BitPlane &dst, Rule const rule, int const fromY, int const toY)
+    {
+        static std::vector<uint64_t> const outside(WORDS, ~uint64_t(0));
+
+        for (int y = fromY; y < toY; y++)
+        {
+            auto const above = y + 1 < WORLD_HEIGHT ? src.row(y + 1) : outside.data();
+            auto const middle = src.row(y);
+            auto const below = y > 0 ? src.row(y - 1) : outside.data();
+            auto const out = dst.row(y);
+
+            for (int w = 0; w < WORDS; w++)
+            {
+                // bit x of these is the cell x - 1 or x + 1 respectively
+                auto const west = [w](uint64_t const *const r)
+                { return (r[w] << 1) | (w > 0 ? r[w - 1] >> 63 : 1); };
+                auto const east = [w](uint64_t const *const r)
+                { return (r[w] >> 1) | (w + 1 < WORDS ? r[w + 1] << 63 : uint64_t(1) << 63); };
+
+                uint64_t const n[8] = {
+                    west(above), above[w], east(above),
+                    west(middle), east(middle),
+                    west(below), below[w], east(below)};
+
+                // adder tree over the 8 neighbour planes: the count as bits c3 c2 c1 c0
+                auto const fullAdd = [](uint64_t const a, uint64_t const b, uint64_t const c, uint64_t &carry)
+                {
+                    carry = (a & b) | (c & (a ^ b));
+                    return a ^ b ^ c;
+                };
+
+                uint64_t twosA, twosB, twosC, twosD, foursA;
+                auto const onesA = fullAdd(n[0], n[1], n[2], twosA);
+                auto const onesB = fullAdd(n[3], n[4], n[5], twosB);
+                auto const onesC = n[6] ^ n[7];
+                twosC = n[6] & n[7];
+                auto const c0 = fullAdd(onesA, onesB, onesC, twosD);
+
+                auto const twosSum = fullAdd(twosA, twosB, twosC, foursA);
+                auto const c1 = twosSum ^ twosD;
+                auto const foursB = twosSum & twosD;
+                auto const c2 = foursA ^ foursB;
+                auto const c3 = foursA & foursB;
+
+                auto const alive = middle[w];
+                auto const result = (alive & atLeast(c0, c1, c2, c3, rule.survival)) |
+                                    (~alive & atLeast(c0, c1, c2, c3, rule.birth));
+
+                out[w] = w + 1 == WORDS ? result | PADDING : result;
+            }
+        }
+    }
+}
+
+// ========================================================================
+
+// sky light: the cells above the height map are lit fully, the light spreads
+// through the cells without a foreground tile and loses a level per step
+namespace Lighting
+{
+    // light travels at most LIGHT_MAX - 1 cells, a band lit with this margin is exact
+    constexpr int HALO = World::LIGHT_MAX;
+
+    // the buffers of a propagation, kept by the caller so that repeated lighting reuses their capacity
+    struct Scratch
+    {
+        std::vector<uint8_t> light;
+        std::vector<uint8_t> open;
+        std::vector<uint32_t> buckets[World::LIGHT_MAX + 1]; // one bucket of cells per level
+    };
+
+    // lights the box [minX; maxX) x [minY; maxY) and writes the columns [writeMinX; writeMaxX) of it back,
+    // with `fromBorder` the cells around the box keep their light and shine into it
+    void propagate(World *const world, Scratch &scratch, int const minX, int const minY, int const maxX, int const maxY,
+                   int const writeMinX, int const writeMaxX, bool const fromBorder)
+    {
+        auto const width = maxX - minX;
+        auto const height = maxY - minY;
+        if (width <= 0 || height <= 0)
+            return;
+
+        auto &light = scratch.light;
+        auto &open = scratch.open;
+        auto &buckets = scratch.buckets;
+        light.assign(width * height, 0);
+        open.resize(width * height);
+        for (int y = 0; y < height; y++)
+        {
+            auto const row = world->getRow(minY + y) + minX;
+            for (int x = 0; x < width; x++)
+                open[x + y * width] = row[x] == AIR;
+        }
+
+        // a cell is expanded once from its final level
+        for (auto &bucket : buckets)
+            bucket.clear();
+        auto const raise = [&](int const index, int const level)
+        {
+            if (open[index] && light[index] < level)
+            {
+                light[index] = uint8_t(level);
+                buckets[level].push_back(uint32_t(index));
+            }
+        };
+
+        // only the sky cells next to a shaded one have to spread
+        for (int x = 0; x < width; x++)
+        {
+            auto const sky = world->getHeightAt(minX + x) + 1;
+            auto const left = x > 0 ? world->getHeightAt(minX + x - 1) : -1;
+            auto const right = x < width - 1 ? world->getHeightAt(minX + x + 1) : -1;
+
+            for (int y = std::max(sky, minY); y < maxY; y++)
+            {
+                auto const index = x + (y - minY) * width;
+                light[index] = World::LIGHT_MAX;
+                if (y == sky || y <= left || y <= right)
+                    buckets[World::LIGHT_MAX].push_back(uint32_t(index));
+            }
+        }
+
+        if (fromBorder)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                if (minY > 0)
+                    raise(x, world->getLightAt(minX + x, minY - 1) - 1);
+                if (maxY < WORLD_HEIGHT)
+                    raise(x + (height - 1) * width, world->getLightAt(minX + x, maxY) - 1);
+            }
+            for (int y = 0; y < height; y++)
+            {
+                if (minX > 0)
+                    raise(y * width, world->getLightAt(minX - 1, minY + y) - 1);
+                if (maxX < WORLD_WIDTH)
+                    raise(width - 1 + y * width, world->getLightAt(maxX, minY + y) - 1);
+            }
+        }
+
+        for (int level = World::LIGHT_MAX; level > 1; level--)
+            for (auto const index : buckets[level])
+            {
+                if (light[index] != level)
+                    continue;
+
+                auto const x = int(index % width);
+                if (x > 0)
+                    raise(index - 1, level - 1);
+                if (x < width - 1)
+                    raise(index + 1, level - 1);
+                if (index >= uint32_t(width))
+                    raise(index - width, level - 1);
+                if (index < uint32_t(width * (height - 1)))
+                    raise(index + width, level - 1);
+            }
+
+        for (int y = 0; y < height; y++)
+            std::copy_n(light.data() + writeMinX - minX + y * width, writeMaxX - writeMinX,
+                        world->getLightRow(minY + y) + writeMinX);
+    }
+
+    // the light of the columns [fromX; toX), disjoint bands can be lit concurrently
+    void lightColumns(World *const world, Scratch &scratch, int const fromX, int const toX)
+    {
+        propagate(world, scratch, std::max(0, fromX - HALO), 0, std::min(WORLD_WIDTH, toX + HALO), WORLD_HEIGHT,
+                  fromX, toX, false);
+    }
+
+    // after the tiles of the rectangle changed, the light around it has to be up to date
+    void relight(World *const world, Scratch &scratch, int minX, int minY, int maxX, int maxY)
+    {
+        minX = std::max(0, minX);
+        minY = std::max(0, minY);
+        maxX = std::min(WORLD_WIDTH, maxX);
+        maxY = std::min(WORLD_HEIGHT, maxY);
+        if (minX >= maxX || minY >= maxY)
+            return;
+
+        // the sky may reach lower or higher than before, only the sky has the full light
+        auto low = minY;
+        for (int x = minX; x < maxX; x++)
+        {
+            auto y = std::min(minY, world->getHeightAt(x) + 1) - 1;
+            while (y >= 0 && world->getLightRow(y)[x] == World::LIGHT_MAX)
+                --y;
+            low = std::min(low, y + 1);
+        }
+
+        minX = std::max(0, minX - HALO);
+        maxX = std::min(WORLD_WIDTH, maxX + HALO);
+        propagate(world, scratch, minX, std::max(0, low - HALO), maxX, std::min(WORLD_HEIGHT, maxY + HALO),
+                  minX, maxX, true);
+    }
+}
+
+// ========================================================================
+
+// threads kept alive between jobs, so that running a job neither starts threads nor allocates
+class WorkerPool
+{
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable finished;
+
+    void (*job)(void const *) = nullptr;
+    void const *jobContext = nullptr;
+    uint64_t jobCount = 0;
+    size_t running = 0;
+    bool stopping = false;
+
+    void work(uint64_t seen)
+    {
+        std::unique_lock lock(mutex);
+        while (true)
+        {
+            wakeUp.wait(lock, [&] { return stopping || jobCount != seen; });
+            if (stopping)
+                return;
+
+            seen = jobCount;
+            auto const current = job;
+            auto const context = jobContext;
+            lock.unlock();
+            current(context);
+            lock.lock();
+
+            if (--running == 0)
+                finished.notify_one();
+        }
+    }
+
+public:
+    WorkerPool() = default;
+    WorkerPool(WorkerPool const &) = delete;
+    WorkerPool &operator=(WorkerPool const &) = delete;
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // calls `function` on this thread and on at least `helpers` pool threads, returns once all calls returned;
+    // every thread of the pool takes part, so `function` has to share out the work itself
+    template <typename Function>
+    void run(size_t const helpers, Function const &function)
+    {
+        if (helpers == 0)
+        {
+            function();
+            return;
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            while (threads.size() < helpers)
+                threads.emplace_back(&WorkerPool::work, this, jobCount);
+
+            job = [](void const *context) { (*static_cast<Function const *>(context))(); };
+            jobContext = &function;
+            running = threads.size();
+            jobCount++;
+        }
+        wakeUp.notify_all();
+
+        function();
+
+        std::unique_lock lock(mutex);
+        finished.wait(lock, [&] { return running == 0; });
+    }
+};
+
+// ========================================================================
+
+// Poisson-disk sampling: accepted points keep a minimum distance to each other,
+// the candidates are only compared with the points of the surrounding grid cells
+class PoissonDiskGrid
+{
+private:
+    struct Point
+    {
+        int x;
+        int y;
+        int spacing;
+    };
+
+    int cellSize;
+    int columns;
+    int rows;
+    int maxSpacing = 0;
+
+    std::vector<Point> points;
+    std::vector<std::vector<uint32_t>> cells;
+
+public:
+    // cells of minSpacing / sqrt(2) hold at most one point of that spacing
+    explicit PoissonDiskGrid(int const minSpacing)
+        : cellSize(std::max(1, int(minSpacing / 1.41421356f))),
+          columns((WORLD_WIDTH + cellSize - 1) / cellSize),
+          rows((WORLD_HEIGHT + cellSize - 1) / cellSize),
+          cells(columns * rows) {}
+
+    // inserts the point unless it is closer than max(spacing, their spacing) to another one
+    bool tryInsert(int const x, int const y, int const spacing)
+    {
+        auto const cellX = std::clamp(x / cellSize, 0, columns - 1);
+        auto const cellY = std::clamp(y / cellSize, 0, rows - 1);
+        auto const reach = (std::max(spacing, maxSpacing) + cellSize - 1) / cellSize;
+
+        for (int cy = std::max(0, cellY - reach); cy <= std::min(rows - 1, cellY + reach); cy++)
+            for (int cx = std::max(0, cellX - reach); cx <= std::min(columns - 1, cellX + reach); cx++)
+                for (auto const id : cells[cx + cy * columns])
+                {
+                    auto const &other = points[id];
+                    auto const distance = std::max(spacing, other.spacing);
+                    auto const dx = x - other.x;
+                    auto const dy = y - other.y;
+
+                    if (dx * dx + dy * dy < distance * distance)
+                        return false;
+                }
+
+        cells[cellX + cellY * columns].push_back(uint32_t(points.size()));
+        points.push_back({x, y, spacing});
+        maxSpacing = std::max(maxSpacing, spacing);
+        return true;
+    }
+};
+
+// ========================================================================
+
+class WorldGenerator
+{
+    friend class BenchmarkSuite;
+
+private:
+    float fractalNoise(int octaves, float x, float y = 0, float z = 0)
+    {
+        auto result = 0.f;
+        auto scale = 1.0f;
+        auto k = 0.5f;
+
+        for (int i = 0; i < octaves; i++)
+        {
+            scale *= 0.5f;
+            k *= 2.f;
+
+            result += scale * (noise3(x * k, y * k, z * k) + 1.0f) * 0.5f;
+        }
+
+        return result;
+    }
+
+    // the z slice of the terrain noise (was rand() % 256), the terrain does not depend on anything else
+    int terrainSeed = 1;
+
+    NoiseMode noiseMode = DEFAULT_NOISE_MODE;
+
+    // the surface only depends on x, so it is sampled once per column instead of once per cell
+    float surface[WORLD_WIDTH];
+    int64_t fixedSurface[WORLD_WIDTH]; // Q16, with NoiseMode::FIXED
+
+    void genSurface(int const fromX = 0, int const toX = WORLD_WIDTH)
+    {
+        if (noiseMode == NoiseMode::FIXED)
+        {
+            Noise::Fixed::Fractal<3> const surfaceNoise(terrainSeed * Noise::Fixed::ONE, 0);
+            for (int x = fromX; x < toX; x++)
+                fixedSurface[x] = surfaceNoise(int64_t(x) << (Noise::Fixed::SHIFT - 7));
+            return;
+        }
+
+        Noise::Fractal<3> const surfaceNoise(terrainSeed, 0.f);
+        for (int x = fromX; x < toX; x++)
+            surface[x] = surfaceNoise(x / 128.f);
+    }
+
+    // genSoilRow() with integer thresholds, the same constants in Q16
+    void genSoilRowFixed(World *const world, int const y, int const fromX, int const toX)
+    {
+        using namespace Noise::Fixed;
+
+        auto const z = terrainSeed * ONE;
+
+        Fractal<3> const stoneNoise(int64_t(y) << (SHIFT - 6), z);
+        Fractal<2> const caveNoise(int64_t(y) << (SHIFT - 4), z + ONE);
+
+        // 0.385 * 0.85 and 0.3 in Q16
+        constexpr int64_t CAVE_THRESHOLD = 21446;
+        constexpr int64_t STONE_THRESHOLD = 19661;
+
+        for (int x = fromX; x < toX; x++)
+        {
+            auto const n3 = caveNoise(int64_t(x) << (SHIFT - 5));
+
+            if (n3 > CAVE_THRESHOLD)
+            {
+                if (y * ONE < fixedSurface[x] * WORLD_HEIGHT)
+                    world->setTile(x, y, SOIL);
+
+                auto const n2 = stoneNoise(int64_t(x) << (SHIFT - 6));
+                if (n2 * (WORLD_HEIGHT - y) > STONE_THRESHOLD * WORLD_HEIGHT)
+                    world->setTile(x, y, STONE);
+            }
+        }
+    }
+
+    // the columns [fromX; toX) of the row, bands of columns can be generated concurrently
+    void genSoilRow(World *const world, int const y, int const fromX = 0, int const toX = WORLD_WIDTH)
+    {
+        if (noiseMode == NoiseMode::FIXED)
+        {
+            genSoilRowFixed(world, y, fromX, toX);
+            return;
+        }
+
+        auto const z = terrainSeed;
+
+        // y and z are fixed along the row
+        Noise::Fractal<3> const stoneNoise(y / 64.f, z);
+        Noise::Fractal<2> const caveNoise(y / 16.f, z + 1.f);
+
+        for (int x = fromX; x < toX; x++)
+        {
+            auto const n1 = surface[x];
+            auto const n3 = caveNoise(x / 32.f);
+
+            if (n3 > 0.385 * 0.85)
+            {
+                if (y < n1 * WORLD_HEIGHT)
+                    world->setTile(x, y, SOIL);
+
+                // only needed for the solid cells
+                auto const n2 = stoneNoise(x / 64.f) * (WORLD_HEIGHT - y) / WORLD_HEIGHT;
+                if (n2 > 0.3f)
+                    world->setTile(x, y, STONE);
+            }
+            /*if (y < (WORLD_HEIGHT >> 1))
+                world->setTile(x, y, STONE);*/
+        }
+    }
+
+    void genSoil(World *const world)
+    {
+        PROFILE_SCOPE("WorldGenerator::genSoil");
+
+        genSurface();
+
+        for (int y = 0; y < WORLD_HEIGHT; y++)
+        {
+            genSoilRow(world, y);
+
+            if (progress)
+            {
+                progress->publishRows(world, 0, WORLD_WIDTH, y, y + 1);
+                if (progress->isCancelled())
+                    return;
+            }
+        }
+    }
+
+    void genSoilBand(World *const world, int const fromX, int const toX)
+    {
+        genSurface(fromX, toX);
+
+        for (int y = 0; y < WORLD_HEIGHT; y++)
+        {
+            if (progress && progress->isCancelled())
+                return;
+
+            genSoilRow(world, y, fromX, toX);
+            if (progress)
+                progress->publishRows(world, fromX, toX, y, y + 1);
+        }
+    }
+
+    StructureProvider provider;
+    StructureBuilder builder;
+    std::mt19937 rng;
+    GenerationProgress *progress = nullptr;
+
+    // the world right after genSoil, regenerations with the same terrain start from a copy of it
+    std::unique_ptr<World> terrainCache;
+    std::optional<int> terrainCacheSeed;
+
+    bool restoreTerrain(World *const world)
+    {
+        if (terrainWaves == 0 || terrainCacheSeed != terrainSeed)
+            return false;
+
+        PROFILE_COUNT("terrain cache hits", 1);
+        *world = *terrainCache;
+
+        if (progress)
+            progress->publishRows(world, 0, WORLD_WIDTH, 0, WORLD_HEIGHT);
+
+        return true;
+    }
+
+    void storeTerrain(World const *const world)
+    {
+        // a cancelled generation has no complete terrain
+        if (progress && progress->isCancelled())
+            return;
+
+        if (!terrainCache)
+            terrainCache = std::make_unique<World>();
+
+        *terrainCache = *world;
+        terrainCacheSeed = terrainSeed;
+    }
+
+    std::unordered_map<std::string, LayoutMetric> layoutMetrics;
+
+    // one per worker of sampleLayouts()
+    std::vector<std::unique_ptr<StructureBuilder>> sampleBuilders;
+    std::vector<std::unique_ptr<World>> sampleWorlds;
+
+    // expands the base at (x, y) with `samples` seeds of their own on copies of the world,
+    // returns the seed of the best layout, the result does not depend on the number of threads
+    uint32_t sampleLayouts(World const *const world, int const x, int const y, int const samples, LayoutMetric const metric)
+    {
+        PROFILE_SCOPE("WorldGenerator::sampleLayouts");
+
+        std::vector<uint32_t> seeds(samples);
+        for (auto &seed : seeds)
+            seed = rng();
+
+        auto const workers = std::max(1, std::min(int(std::thread::hardware_concurrency()), samples));
+        while (sampleBuilders.size() < size_t(workers))
+        {
+            sampleBuilders.emplace_back(std::make_unique<StructureBuilder>());
+            sampleWorlds.emplace_back(std::make_unique<World>());
+        }
+
+        for (int i = 0; i < workers; i++)
+        {
+            auto &sampleBuilder = *sampleBuilders[i];
+            sampleBuilder.attachTileRegistry(tileRegistry);
+            sampleBuilder.attachStructureProvider(&provider);
+            sampleBuilder.attachWorld(sampleWorlds[i].get());
+            sampleBuilder.attachProgress(progress);
+        }
+
+        std::vector<double> scores(samples);
+        std::atomic<int> nextSample{0};
+
+        auto const work = [&](int const worker)
+        {
+            auto &sampleBuilder = *sampleBuilders[worker];
+            auto &sampleWorld = *sampleWorlds[worker];
+            auto copied = false;
+
+            for (auto i = nextSample++; i < samples; i = nextSample++)
+            {
+                // the world is copied once, later only the boxes of the previous layout are restored
+                if (!copied)
+                    sampleWorld = *world;
+                else
+                {
+                    auto const &complexes = sampleBuilder.getComplexes();
+                    for (auto const root : complexes.getRoots())
+                    {
+                        auto const &box = complexes.getBounds(root);
+                        sampleWorld.copyRegion(*world, box.x, box.y, box.width, box.height);
+                    }
+                }
+                copied = true;
+
+                sampleBuilder.reset();
+                sampleBuilder.seed(seeds[i]);
+                sampleBuilder.requestStructureAt(x, y, "room/base", "#floor", 0);
+                sampleBuilder.processAllRequests();
+                scores[i] = metric(sampleBuilder);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < workers; i++)
+            threads.emplace_back(work, i);
+        work(0);
+
+        for (auto &thread : threads)
+            thread.join();
+
+        // the first of the best ones
+        return seeds[std::max_element(scores.begin(), scores.end()) - scores.begin()];
+    }
+
+    // with several samples only the best layout is built
+    void requestBase(World *const world, int const samples = 1, std::string const &metric = "pieces")
+    {
+        // builds the joint candidates on the first call
+        provider.preload("room/base");
+
+        int const startX = 15 + rng() % (WORLD_WIDTH_M1 - 15 * 2);
+        int const startY = world->getHeightAt(startX) - 2;
+
+        if (samples > 1)
+            builder.seed(sampleLayouts(world, startX, startY, samples, layoutMetrics.at(metric)));
+
+        builder.requestStructureAt(startX, startY, "room/base", "#floor", 0);
+    }
+
+    void genBase(World *const world, int const samples = 1, std::string const &metric = "pieces")
+    {
+        PROFILE_SCOPE("WorldGenerator::genBase");
+
+        if (progress && progress->isCancelled())
+            return;
+
+        requestBase(world, samples, metric);
+        builder.processAllRequests();
+    }
+
+    // structure roots from res/seeding.json, without the file a single base is placed by genBase
+    std::optional<Configuration::Seeding> seeding;
+    bool seedingLoaded = false;
+
+    // threads of genSites(), 0 - one per core
+    int siteWorkers = 0;
+
+    struct Site
+    {
+        int x;
+        int y;
+        Configuration::Seeding::Root const *root;
+        uint32_t seed;
+
+        // every site expands in its own columns, so the sites can not interact
+        int minX;
+        int maxX;
+    };
+
+    std::vector<Site> sites;
+    TileRegistry const *tileRegistry = nullptr;
+
+    // one per worker thread of genSites
+    std::vector<std::unique_ptr<StructureBuilder>> siteBuilders;
+
+    void loadSeeding()
+    {
+        if (seedingLoaded)
+            return;
+
+        seedingLoaded = true;
+        if (std::ifstream in("../../res/seeding.json"); in)
+            seeding = nlohmann::json::parse(in).get<Configuration::Seeding>();
+    }
+
+    void sampleSites(World const *const world)
+    {
+        sites.clear();
+
+        auto minSpacing = WORLD_WIDTH;
+        for (auto const &root : seeding->roots)
+            minSpacing = std::min(minSpacing, root.minSpacing);
+
+        PoissonDiskGrid grid(minSpacing);
+
+        // dart throwing along the surface, the root types are served in the order of the file
+        for (auto const &root : seeding->roots)
+        {
+            auto const wanted = int(std::lround(root.density * WORLD_WIDTH));
+            auto placed = 0;
+
+            for (int attempt = 0; attempt < wanted * 30 && placed < wanted; attempt++)
+            {
+                int const x = 15 + rng() % (WORLD_WIDTH_M1 - 15 * 2);
+                int const y = world->getHeightAt(x) - root.depth;
+
+                if (grid.tryInsert(x, y, root.minSpacing))
+                {
+                    sites.push_back({x, y, &root, 0, 0, 0});
+                    placed++;
+                }
+            }
+        }
+
+        // the columns are split half-way between the neighbouring sites
+        std::sort(sites.begin(), sites.end(), [](Site const &a, Site const &b) { return a.x < b.x; });
+
+        for (size_t i = 0; i < sites.size(); i++)
+        {
+            auto &site = sites[i];
+            site.seed = rng();
+            site.minX = i == 0 ? 0 : (sites[i - 1].x + site.x) / 2;
+            site.maxX = i + 1 == sites.size() ? WORLD_WIDTH : (site.x + sites[i + 1].x) / 2;
+        }
+
+        // builders of other threads must not load structures
+        for (auto const &root : seeding->roots)
+            provider.preload(root.structureId);
+    }
+
+    static void startSite(StructureBuilder &siteBuilder, Site const &site)
+    {
+        siteBuilder.setRegion(site.minX, site.maxX);
+        siteBuilder.seed(site.seed);
+        siteBuilder.requestStructureAt(site.x, site.y, site.root->structureId, site.root->joint, 0);
+    }
+
+    // expands the sites on several threads, the result does not depend on the number of threads
+    void genSites(World *const world)
+    {
+        PROFILE_SCOPE("WorldGenerator::genSites");
+
+        sampleSites(world);
+
+        auto const cores = siteWorkers > 0 ? size_t(siteWorkers) : size_t(std::thread::hardware_concurrency());
+        auto const workers = std::max<size_t>(1, std::min(cores, sites.size()));
+        while (siteBuilders.size() < workers)
+            siteBuilders.emplace_back(std::make_unique<StructureBuilder>());
+
+        for (size_t i = 0; i < workers; i++)
+        {
+            auto &siteBuilder = *siteBuilders[i];
+            siteBuilder.reset();
+            siteBuilder.attachTileRegistry(tileRegistry);
+            siteBuilder.attachStructureProvider(&provider);
+            siteBuilder.attachWorld(world);
+            siteBuilder.attachProgress(progress);
+        }
+
+        // worker, [first; last) of its placements
+        std::vector<std::array<size_t, 3>> results(sites.size());
+        std::atomic<size_t> nextSite{0};
+
+        auto const work = [&](size_t const worker)
+        {
+            auto &siteBuilder = *siteBuilders[worker];
+
+            for (auto i = nextSite++; i < sites.size(); i = nextSite++)
+            {
+                auto const first = siteBuilder.getPlacements().size();
+                startSite(siteBuilder, sites[i]);
+                siteBuilder.processAllRequests();
+                results[i] = {worker, first, siteBuilder.getPlacements().size()};
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < workers; i++)
+            threads.emplace_back(work, i);
+        work(0);
+
+        for (auto &thread : threads)
+            thread.join();
+
+        // collect in the order of the sites
+        for (auto const &[worker, first, last] : results)
+            builder.absorb(*siteBuilders[worker], first, last);
+    }
+
+    // pipeline stages work on the columns [fromX; toX) of the world
+    using StageFunction = void (WorldGenerator::*)(World *, Configuration::Pipeline::Stage const &, int, int);
+
+    struct StageType
+    {
+        StageFunction run;
+        bool chunkable; // bands of columns are independent
+        bool seeded;    // uses the generation seed, the stages before it are cached
+    };
+
+    std::unordered_map<std::string, StageType> stageTypes;
+
+    void runSoilStage(World *const world, Configuration::Pipeline::Stage const &, int const fromX, int const toX)
+    {
+        if (fromX == 0 && toX == WORLD_WIDTH)
+            genSoil(world);
+        else
+            genSoilBand(world, fromX, toX);
+    }
+
+    // parameters: "samples" layouts of the base to pick the best from by the "metric" (see registerLayoutMetric())
+    void runStructureStage(World *const world, Configuration::Pipeline::Stage const &config, int, int)
+    {
+        if (seeding)
+            genSites(world);
+        else
+            genBase(world, config.parameters.value("samples", 1), config.parameters.value("metric", "pieces"));
+    }
+
+    // parameters: "iterations", "birth" and "survival" neighbour counts of the automaton
+    void runCaveSmoothingStage(World *const world, Configuration::Pipeline::Stage const &config, int, int)
+    {
+        auto const iterations = config.parameters.value("iterations", 3);
+        Automaton::Rule const rule = {
+            config.parameters.value("birth", 5),
+            config.parameters.value("survival", 4),
+        };
+
+        // solid cells as bits
+        Automaton::BitPlane original;
+        for (int y = 0; y < WORLD_HEIGHT; y++)
+        {
+            auto const tiles = world->getRow(y);
+            auto const bits = original.row(y);
+            std::fill(bits, bits + Automaton::WORDS, 0);
+            for (int x = 0; x < WORLD_WIDTH; x++)
+                bits[x >> 6] |= uint64_t(tiles[x] != AIR) << (x & 63);
+            bits[Automaton::WORDS - 1] |= Automaton::PADDING;
+        }
+
+        // bands of rows on several threads, each generation waits for the previous one
+        Automaton::BitPlane current = original;
+        Automaton::BitPlane next;
+
+        auto const bands = std::max(1, std::min(int(std::thread::hardware_concurrency()), WORLD_HEIGHT / 16));
+        auto const bandHeight = (WORLD_HEIGHT + bands - 1) / bands;
+
+        for (int i = 0; i < iterations; i++)
+        {
+            std::vector<std::thread> threads;
+            for (int band = 1; band < bands; band++)
+                threads.emplace_back(
+                    Automaton::step, std::cref(current), std::ref(next), rule,
+                    band * bandHeight, std::min(WORLD_HEIGHT, (band + 1) * bandHeight));
+            Automaton::step(current, next, rule, 0, std::min(WORLD_HEIGHT, bandHeight));
+
+            for (auto &thread : threads)
+                thread.join();
+
+            std::swap(current, next);
+        }
+
+        // the new tiles are decided on the unchanged world first, filled cells take the more common neighbour material
+        struct Change
+        {
+            int x;
+            int y;
+            TileId tile;
+        };
+
+        std::vector<Change> changes;
+        for (int y = 0; y < WORLD_HEIGHT; y++)
+            for (int w = 0; w < Automaton::WORDS; w++)
+            {
+                auto const changed = current.row(y)[w] ^ original.row(y)[w];
+                for (int bit = 0; changed && bit < 64; bit++)
+                {
+                    if (!(changed >> bit & 1))
+                        continue;
+
+                    auto const x = w * 64 + bit;
+                    auto const tile = world->getTileAt(x, y);
+
+                    if (tile == SOIL || tile == STONE)
+                        changes.push_back({x, y, AIR});
+                    else if (tile == AIR)
+                    {
+                        auto stone = 0;
+                        auto soil = 0;
+                        for (int dy = -1; dy <= 1; dy++)
+                            for (int dx = -1; dx <= 1; dx++)
+                            {
+                                auto const neighbour = world->getTileAt(x + dx, y + dy);
+                                stone += neighbour == STONE;
+                                soil += neighbour == SOIL;
+                            }
+
+                        changes.push_back({x, y, stone >= soil ? STONE : SOIL});
+                    }
+                }
+            }
+
+        for (auto const &change : changes)
+            world->setTile(change.x, change.y, change.tile);
+    }
+
+    // bands of columns light in parallel, each with a margin of its neighbours' tiles
+    void runSkyLightStage(World *const world, Configuration::Pipeline::Stage const &, int const fromX, int const toX)
+    {
+        Lighting::lightColumns(world, lightScratch[fromX / STAGE_BAND_WIDTH], fromX, toX);
+    }
+
+    static constexpr int STAGE_BAND_WIDTH = 128;
+
+    // one per band, kept across generations
+    std::vector<Lighting::Scratch> lightScratch = std::vector<Lighting::Scratch>((WORLD_WIDTH + STAGE_BAND_WIDTH - 1) / STAGE_BAND_WIDTH);
+
+    // used without res/pipeline.json
+    static constexpr char const *DEFAULT_PIPELINE = R"({
+        "stages": [
+            {"name": "terrain", "type": "soil", "writes": ["tiles"], "chunked": true},
+            {"name": "caves", "type": "cave-smoothing", "reads": ["tiles"], "writes": ["tiles"]},
+            {"name": "structures", "type": "structures", "reads": ["tiles"], "writes": ["tiles", "rng"]},
+            {"name": "light", "type": "sky-light", "reads": ["tiles"], "writes": ["light"], "chunked": true}
+        ]
+    })";
+
+    struct ScheduledStage
+    {
+        Configuration::Pipeline::Stage const *config;
+        StageType const *type;
+        int wave;
+    };
+
+    Configuration::Pipeline pipeline;
+    bool pipelineLoaded = false;
+
+    // ordered by wave, the stages of a wave do not conflict with each other
+    std::vector<ScheduledStage> schedule;
+    int waveCount = 0;
+
+    // the leading waves without seeded stages make up the cached terrain
+    int terrainWaves = 0;
+    size_t terrainStages = 0;
+
+public:
+    struct StageTiming
+    {
+        std::string name;
+        int wave;
+        int tasks;
+        double wallMs;
+        double busyMs; // summed over the tasks
+    };
+
+private:
+    std::vector<StageTiming> stageTimings;
+
+    static bool conflicts(Configuration::Pipeline::Stage const &a, Configuration::Pipeline::Stage const &b)
+    {
+        auto const contains = [](std::vector<std::string> const &layers, std::string const &layer)
+        { return std::find(layers.cbegin(), layers.cend(), layer) != layers.cend(); };
+
+        for (auto const &layer : a.writes)
+            if (contains(b.reads, layer) || contains(b.writes, layer))
+                return true;
+
+        for (auto const &layer : a.reads)
+            if (contains(b.writes, layer))
+                return true;
+
+        return false;
+    }
+
+    // the parameters of the structures stage are only used in the middle of the generation
+    void checkStructureParameters(Configuration::Pipeline::Stage const &description) const
+    {
+        auto const metric = description.parameters.value("metric", "pieces");
+        if (layoutMetrics.count(metric) == 0)
+            throw std::runtime_error("pipeline: unknown metric '" + metric + "' of " + description.name);
+        if (description.parameters.value("samples", 1) < 1)
+            throw std::runtime_error("pipeline: stage " + description.name + " needs at least 1 sample");
+    }
+
+    void loadPipeline()
+    {
+        if (pipelineLoaded)
+            return;
+
+        pipelineLoaded = true;
+        if (std::ifstream in("../../res/pipeline.json"); in)
+            pipeline = nlohmann::json::parse(in).get<Configuration::Pipeline>();
+        else
+            pipeline = nlohmann::json::parse(DEFAULT_PIPELINE).get<Configuration::Pipeline>();
+
+        // every stage goes to the first wave after all earlier stages it conflicts with
+        for (auto const &description : pipeline.stages)
+        {
+            auto const type = stageTypes.find(description.type);
+            if (type == stageTypes.cend())
+                throw std::runtime_error(
+                    "pipeline: unknown stage type '" + description.type + "' of " + description.name);
+            if (description.chunked && !type->second.chunkable)
+                throw std::runtime_error("pipeline: stage " + description.name + " can not be chunked");
+            if (description.type == "structures")
+                checkStructureParameters(description);
+
+            auto wave = 0;
+            for (auto const &earlier : schedule)
+                if (conflicts(description, *earlier.config))
+                    wave = std::max(wave, earlier.wave + 1);
+
+            schedule.push_back({&description, &type->second, wave});
+            waveCount = std::max(waveCount, wave + 1);
+        }
+
+        std::stable_sort(
+            schedule.begin(), schedule.end(),
+            [](ScheduledStage const &a, ScheduledStage const &b) { return a.wave < b.wave; });
+
+        terrainWaves = waveCount;
+        for (auto const &scheduled : schedule)
+            if (scheduled.type->seeded)
+                terrainWaves = std::min(terrainWaves, scheduled.wave);
+
+        terrainStages = 0;
+        while (terrainStages < schedule.size() && schedule[terrainStages].wave < terrainWaves)
+            terrainStages++;
+    }
+
+    struct WaveTask
+    {
+        size_t stage;
+        int fromX;
+        int toX;
+    };
+
+    using WaveClock = std::chrono::steady_clock;
+
+    // reused by every wave
+    std::vector<WaveTask> waveTasks;
+    std::vector<std::array<WaveClock::time_point, 2>> waveTaskTimes;
+    WorkerPool stageWorkers;
+
+    // runs the stages of the wave, chunked ones split into bands of columns, on several threads
+    void runWave(World *const world, int const wave)
+    {
+        auto &tasks = waveTasks;
+        tasks.clear();
+        for (size_t i = 0; i < schedule.size(); i++)
+        {
+            if (schedule[i].wave != wave)
+                continue;
+
+            if (schedule[i].config->chunked)
+                for (int x = 0; x < WORLD_WIDTH; x += STAGE_BAND_WIDTH)
+                    tasks.push_back({i, x, std::min(x + STAGE_BAND_WIDTH, WORLD_WIDTH)});
+            else
+                tasks.push_back({i, 0, WORLD_WIDTH});
+        }
+
+        auto &taskTimes = waveTaskTimes;
+        taskTimes.resize(tasks.size());
+        std::atomic<size_t> nextTask{0};
+
+        auto const work = [&]()
+        {
+            for (auto i = nextTask++; i < tasks.size(); i = nextTask++)
+            {
+                auto const &task = tasks[i];
+                auto const &scheduled = schedule[task.stage];
+                PROFILE_SCOPE("stage/", scheduled.config->name);
+
+                taskTimes[i][0] = WaveClock::now();
+                (this->*scheduled.type->run)(world, *scheduled.config, task.fromX, task.toX);
+                taskTimes[i][1] = WaveClock::now();
+            }
+        };
+
+        auto const workers = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), tasks.size()));
+        stageWorkers.run(workers - 1, work);
+
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            auto &timing = stageTimings[tasks[i].stage];
+            auto const [start, end] = taskTimes[i];
+            timing.tasks++;
+            timing.busyMs += std::chrono::duration<double, std::milli>(end - start).count();
+
+            // the wall time of a stage spans from its first to its last task
+            auto first = start;
+            auto last = end;
+            for (size_t j = 0; j < tasks.size(); j++)
+                if (tasks[j].stage == tasks[i].stage)
+                {
+                    first = std::min(first, taskTimes[j][0]);
+                    last = std::max(last, taskTimes[j][1]);
+                }
+            timing.wallMs = std::chrono::duration<double, std::milli>(last - first).count();
+        }
+    }
+
+    // state of the time-sliced generation
+    enum class Stage
+    {
+        IDLE,
+        START,
+        NEXT,
+        SURFACE,
+        SOIL,
+        BASE,
+        STRUCTURES,
+        SITES,
+        DONE
+    };
+
+    Stage stage = Stage::IDLE;
+    World *stepWorld = nullptr;
+    size_t scheduleIndex = 0;
+    bool terrainRestored = false;
+    int soilRow = 0;
+    size_t siteIndex = 0;
+    bool siteStarted = false;
+
+    void prepare(World *const world, TileRegistry const *const tileRegistry, uint32_t const seed)
+    {
+        // the same seed always leads to the same world
+        rng.seed(seed);
+
+        loadSeeding();
+        loadPipeline();
+
+        // the roots of res/seeding.json are expanded once each, there are no layouts to sample
+        if (seeding)
+            for (auto const &scheduled : schedule)
+                if (scheduled.config->type == "structures" &&
+                    (scheduled.config->parameters.contains("samples") || scheduled.config->parameters.contains("metric")))
+                    throw std::runtime_error(
+                        "pipeline: samples of " + scheduled.config->name + " can not be used with res/seeding.json");
+
+        stageTimings.clear();
+        for (auto const &scheduled : schedule)
+            stageTimings.push_back({scheduled.config->name, scheduled.wave, 0, 0., 0.});
+        this->tileRegistry = tileRegistry;
+        provider.attachTileRegistry(tileRegistry);
+
+        builder.reset();
+        builder.seed(rng());
+        builder.attachTileRegistry(tileRegistry);
+        builder.attachStructureProvider(&provider);
+        builder.attachWorld(world);
+        builder.attachProgress(progress);
+    }
+
+public:
+    WorldGenerator()
+    {
+        stageTypes.emplace("soil", StageType{&WorldGenerator::runSoilStage, true, false});
+        stageTypes.emplace("structures", StageType{&WorldGenerator::runStructureStage, false, true});
+        stageTypes.emplace("cave-smoothing", StageType{&WorldGenerator::runCaveSmoothingStage, false, false});
+        stageTypes.emplace("sky-light", StageType{&WorldGenerator::runSkyLightStage, true, false});
+
+        layoutMetrics.emplace("pieces", piecesLayoutMetric);
+        layoutMetrics.emplace("depth", depthLayoutMetric);
+        layoutMetrics.emplace("coverage", coverageLayoutMetric);
+        layoutMetrics.emplace("dangling", danglingLayoutMetric);
+    }
+
+    // for the "metric" of the structures stage
+    void registerLayoutMetric(std::string const &name, LayoutMetric const metric)
+    {
+        layoutMetrics[name] = metric;
+    }
+
+    // optional, lets another thread follow and cancel the generation
+    void attachProgress(GenerationProgress *const generationProgress)
+    {
+        this->progress = generationProgress;
+    }
+
+    // selects another terrain, the structures still follow the seed passed to generate()
+    void setTerrainSeed(int const value)
+    {
+        terrainSeed = value;
+    }
+
+    // replaces res/seeding.json, std::nullopt places the single base
+    void setSeeding(std::optional<Configuration::Seeding> const &value)
+    {
+        seeding = value;
+        seedingLoaded = true;
+    }
+
+    // the result does not depend on it
+    void setSiteWorkers(int const workers)
+    {
+        siteWorkers = workers;
+    }
+
+    // the cached terrain was made with the previous mode
+    void setNoiseMode(NoiseMode const mode)
+    {
+        if (mode != noiseMode)
+            terrainCacheSeed.reset();
+
+        noiseMode = mode;
+    }
+
+    void generate(World *const world, TileRegistry const *const tileRegistry, uint32_t const seed)
+    {
+        PROFILE_RESET();
+        PROFILE_SCOPE("WorldGenerator::generate");
+        PROFILE_ALLOCATIONS("WorldGenerator::generate");
+
+        prepare(world, tileRegistry, seed);
+
+        for (auto wave = restoreTerrain(world) ? terrainWaves : 0; wave < waveCount; wave++)
+        {
+            runWave(world, wave);
+
+            if (wave + 1 == terrainWaves)
+                storeTerrain(world);
+        }
+    }
+
+    // time-sliced alternative to generate(): begin() and then step() once per frame until it returns true,
+    // both lead to the same world
+    void begin(World *const world, TileRegistry const *const tileRegistry, uint32_t const seed)
+    {
+        PROFILE_RESET();
+
+        prepare(world, tileRegistry, seed);
+
+        stepWorld = world;
+        scheduleIndex = 0;
+        terrainRestored = false;
+        stage = Stage::START;
+    }
+
+    // works on the generation for about `budgetUs` microseconds, at least one unit (a terrain row,
+    // a build request, a whole stage of other types) per call; returns true once the world is complete.
+    // the stages run one after another, in the order of their waves
+    bool step(int64_t const budgetUs)
+    {
+        PROFILE_SCOPE("WorldGenerator::step");
+
+        using Clock = std::chrono::steady_clock;
+        auto const deadline = Clock::now() + std::chrono::microseconds(budgetUs);
+
+        do
+        {
+            switch (stage)
+            {
+            case Stage::IDLE:
+            case Stage::DONE:
+                return true;
+
+            case Stage::START:
+                terrainRestored = restoreTerrain(stepWorld);
+                scheduleIndex = terrainRestored ? terrainStages : 0;
+                stage = Stage::NEXT;
+                break;
+
+            case Stage::NEXT:
+            {
+                if (scheduleIndex == terrainStages && terrainStages > 0 && !terrainRestored)
+                    storeTerrain(stepWorld);
+
+                if (scheduleIndex == schedule.size())
+                {
+                    stage = Stage::DONE;
+                    break;
+                }
+
+                // the built-in types have incremental versions
+                auto const &next = schedule[scheduleIndex];
+                if (next.config->type == "soil")
+                    stage = Stage::SURFACE;
+                else if (next.config->type == "structures")
+                    stage = Stage::BASE;
+                else
+                {
+                    (this->*next.type->run)(stepWorld, *next.config, 0, WORLD_WIDTH);
+                    scheduleIndex++;
+                }
+                break;
+            }
+
+            case Stage::SURFACE:
+                genSurface();
+                soilRow = 0;
+                stage = Stage::SOIL;
+                break;
+
+            case Stage::SOIL:
+                genSoilRow(stepWorld, soilRow++);
+                if (progress)
+                    progress->publishRows(stepWorld, 0, WORLD_WIDTH, soilRow - 1, soilRow);
+                if (soilRow == WORLD_HEIGHT)
+                {
+                    scheduleIndex++;
+                    stage = Stage::NEXT;
+                }
+                break;
+
+            case Stage::BASE:
+                if (seeding)
+                {
+                    sampleSites(stepWorld);
+                    siteIndex = 0;
+                    siteStarted = false;
+                    stage = Stage::SITES;
+                }
+                else
+                {
+                    auto const &parameters = schedule[scheduleIndex].config->parameters;
+                    requestBase(stepWorld, parameters.value("samples", 1), parameters.value("metric", "pieces"));
+                    stage = Stage::STRUCTURES;
+                }
+                break;
+
+            case Stage::STRUCTURES:
+                if (builder.processRequestsUntil(deadline))
+                {
+                    scheduleIndex++;
+                    stage = Stage::NEXT;
+                }
+                break;
+
+            // one site after another on the main builder, the regions keep it equal to genSites
+            case Stage::SITES:
+                if (siteIndex == sites.size())
+                {
+                    scheduleIndex++;
+                    stage = Stage::NEXT;
+                }
+                else if (!siteStarted)
+                {
+                    startSite(builder, sites[siteIndex]);
+                    siteStarted = true;
+                }
+                else if (builder.processRequestsUntil(deadline))
+                {
+                    siteIndex++;
+                    siteStarted = false;
+                }
+                break;
+            }
+        } while (Clock::now() < deadline);
+
+        return stage == Stage::DONE;
+    }
+
+    StructureBuilder const &getBuilder() const
+    {
+        return builder;
+    }
+
+    // of the last generate(), in the order of execution
+    std::vector<StageTiming> const &getStageTimings() const
+    {
+        return stageTimings;
+    }
+};
+
+// ========================================================================
+
+namespace Export
+{
+    enum class Format
+    {
+        PNG,         // 8-bit RGBA image
+        PNG_INDEXED, // 8-bit palette image, tile ids are palette indices
+        RGBA,        // raw RGBA rows, top to bottom
+        INDEXED,     // raw tile ids, one byte per cell, top to bottom
+    };
+
+    bool parseFormat(std::string const &name, Format &format)
+    {
+        static std::unordered_map<std::string, Format> const formats = {
+            {"png", Format::PNG},
+            {"png-indexed", Format::PNG_INDEXED},
+            {"rgba", Format::RGBA},
+            {"indexed", Format::INDEXED},
+        };
+
+        if (auto const iter = formats.find(name); iter != formats.cend())
+        {
+            format = iter->second;
+            return true;
+        }
+        else
+            return false;
+    }
+
+    class FileSink
+    {
+    private:
+        int fd = -1;
+        bool owned = false;
+
+    public:
+        explicit FileSink(int const descriptor) : fd(descriptor)
+        {
+#ifdef _WIN32
+            _setmode(fd, _O_BINARY);
+#endif
+        }
+
+        // "-" stands for the standard output
+        explicit FileSink(std::string const &path)
+        {
+            if (path == "-")
+            {
+                fd = 1;
+#ifdef _WIN32
+                _setmode(fd, _O_BINARY);
+#endif
+                return;
+            }
+
+#ifdef _WIN32
+            fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+            owned = fd >= 0;
+        }
+
+        FileSink(FileSink const &) = delete;
+        FileSink &operator=(FileSink const &) = delete;
+
+        ~FileSink()
+        {
+            if (owned)
+#ifdef _WIN32
+                _close(fd);
+#else
+                close(fd);
+#endif
+        }
+
+        bool isOpen() const
+        {
+            return fd >= 0;
+        }
+
+        bool write(void const *data, size_t size)
+        {
+            auto bytes = (uint8_t const *)data;
+
+            // pipes are allowed to accept less than requested
+            while (size > 0)
+            {
+#ifdef _WIN32
+                auto const written = _write(fd, bytes, (unsigned int)size);
+#else
+                auto const written = ::write(fd, bytes, size);
+#endif
+                if (written <= 0)
+                    return false;
+
+                bytes += written;
+                size -= written;
+            }
+
+            return true;
+        }
+    };
+
+    class PngWriter
+    {
+    private:
+        static constexpr size_t CHUNK_SIZE = 1 << 15;
+
+        FileSink *sink = nullptr;
+        z_stream stream = {};
+        std::vector<uint8_t> chunk = std::vector<uint8_t>(CHUNK_SIZE);
+        bool streamReady = false;
+
+        static void putU32(uint8_t *const out, uint32_t const value)
+        {
+            out[0] = value >> 24;
+            out[1] = value >> 16;
+            out[2] = value >> 8;
+            out[3] = value;
+        }
+
+        bool writeChunk(char const *type, uint8_t const *data, uint32_t const size)
+        {
+            uint8_t header[8];
+            putU32(header, size);
+            std::copy(type, type + 4, header + 4);
+
+            // crc32() with a null buffer returns the initial value instead of `crc`
+            auto crc = crc32(0, header + 4, 4);
+            if (size > 0)
+                crc = crc32(crc, data, size);
+
+            uint8_t footer[4];
+            putU32(footer, crc);
+
+            return sink->write(header, sizeof(header)) &&
+                   sink->write(data, size) &&
+                   sink->write(footer, sizeof(footer));
+        }
+
+        bool deflateInput(uint8_t const *data, size_t const size, int const flush)
+        {
+            stream.next_in = (Bytef *)data;
+            stream.avail_in = (uInt)size;
+
+            // every filled output buffer becomes a separate IDAT chunk
+            do
+            {
+                auto const result = deflate(&stream, flush);
+                if (result == Z_STREAM_ERROR)
+                    return false;
+
+                if (stream.avail_out == 0 || (flush == Z_FINISH && result == Z_STREAM_END))
+                {
+                    auto const size = uint32_t(CHUNK_SIZE - stream.avail_out);
+                    if (size > 0 && !writeChunk("IDAT", chunk.data(), size))
+                        return false;
+
+                    stream.next_out = chunk.data();
+                    stream.avail_out = CHUNK_SIZE;
+
+                    if (result == Z_STREAM_END)
+                        break;
+                }
+            } while (stream.avail_in > 0 || flush == Z_FINISH);
+
+            return true;
+        }
+
+    public:
+        explicit PngWriter(FileSink *const output) : sink(output) {}
+
+        PngWriter(PngWriter const &) = delete;
+        PngWriter &operator=(PngWriter const &) = delete;
+
+        ~PngWriter()
+        {
+            if (streamReady)
+                deflateEnd(&stream);
+        }
+
+        // the palette is expected to contain exactly 256 entries for the indexed mode
+        bool begin(int const width, int const height, Color const *const palette)
+        {
+            static uint8_t const signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+            if (!sink->write(signature, sizeof(signature)))
+                return false;
+
+            uint8_t header[13];
+            putU32(header, width);
+            putU32(header + 4, height);
+            header[8] = 8;                // bit depth
+            header[9] = palette ? 3 : 6;  // color type: palette or RGBA
+            header[10] = 0;               // compression
+            header[11] = 0;               // filter method
+            header[12] = 0;               // no interlacing
+            if (!writeChunk("IHDR", header, sizeof(header)))
+                return false;
+
+            if (palette)
+            {
+                uint8_t entries[256 * 3];
+                for (int i = 0; i < 256; i++)
+                {
+                    entries[i * 3 + 0] = palette[i].r;
+                    entries[i * 3 + 1] = palette[i].g;
+                    entries[i * 3 + 2] = palette[i].b;
+                }
+
+                if (!writeChunk("PLTE", entries, sizeof(entries)))
+                    return false;
+            }
+
+            if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+                return false;
+            streamReady = true;
+
+            stream.next_out = chunk.data();
+            stream.avail_out = CHUNK_SIZE;
+            return true;
+        }
+
+        bool writeRow(uint8_t const *const data, size_t const size)
+        {
+            // filter type "none" precedes every scanline
+            static uint8_t const filter = 0;
+
+            return deflateInput(&filter, 1, Z_NO_FLUSH) &&
+                   deflateInput(data, size, Z_NO_FLUSH);
+        }
+
+        bool finish()
+        {
+            return deflateInput(nullptr, 0, Z_FINISH) &&
+                   writeChunk("IEND", nullptr, 0);
+        }
+    };
+
+    bool writeWorld(
+        World const *const world,
+        TileRegistry const *const registry,
+        Format const format,
+        FileSink *const sink)
+    {
+        // resolve the whole palette once instead of a lookup per cell
+        Color palette[256];
+        for (int i = 0; i < 256; i++)
+            palette[i] = registry->getTileColor(TileId(i));
+
+        bool const rgba = format == Format::PNG || format == Format::RGBA;
+        bool const png = format == Format::PNG || format == Format::PNG_INDEXED;
+
+        // a single scanline is all the memory needed
+        std::vector<uint8_t> row(WORLD_WIDTH * (rgba ? sizeof(Color) : sizeof(TileId)));
+        TileId tiles[WORLD_WIDTH];
+
+        PngWriter writer(sink);
+        if (png && !writer.begin(WORLD_WIDTH, WORLD_HEIGHT, rgba ? nullptr : palette))
+            return false;
+
+        // the world is stored bottom to top
+        for (int y = WORLD_HEIGHT_M1; y >= 0; y--)
+        {
+            world->readRegion(0, y, WORLD_WIDTH, 1, tiles, WORLD_WIDTH);
+
+            if (rgba)
+            {
+                auto pixel = (Color *)row.data();
+                for (int x = 0; x < WORLD_WIDTH; x++, pixel++)
+                    *pixel = palette[tiles[x]];
+            }
+            else
+                std::copy(tiles, tiles + WORLD_WIDTH, row.begin());
+
+            if (!(png ? writer.writeRow(row.data(), row.size())
+                      : sink->write(row.data(), row.size())))
+                return false;
+        }
+
+        return png ? writer.finish() : true;
+    }
+
+    static uint32_t getU32(uint8_t const *const in)
+    {
+        return uint32_t(in[0]) << 24 | uint32_t(in[1]) << 16 | uint32_t(in[2]) << 8 | in[3];
+    }
+
+    // decodes what PngWriter writes (8 bits, RGBA or palette, no interlacing, no scanline filters)
+    // into `pixels` top to bottom, every chunk CRC is checked; returns an error message or ""
+    std::string readPng(std::vector<uint8_t> const &file, int &width, int &height, int &channels, std::vector<uint8_t> &pixels)
+    {
+        static uint8_t const signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        if (file.size() < sizeof(signature) || !std::equal(signature, signature + 8, file.begin()))
+            return "no PNG signature";
+
+        std::vector<uint8_t> compressed;
+        auto ended = false;
+        width = height = channels = 0;
+
+        for (size_t offset = 8; offset < file.size() && !ended;)
+        {
+            if (file.size() - offset < 12)
+                return "truncated chunk";
+
+            auto const size = getU32(&file[offset]);
+            auto const type = std::string(file.begin() + offset + 4, file.begin() + offset + 8);
+            if (file.size() - offset - 12 < size)
+                return type + ": truncated";
+
+            auto const data = &file[offset + 8];
+            auto crc = crc32(0, &file[offset + 4], 4);
+            if (size > 0)
+                crc = crc32(crc, data, size);
+            if (crc != getU32(data + size))
+                return type + ": CRC error";
+
+            if (type == "IHDR")
+            {
+                if (size != 13 || data[8] != 8 || (data[9] != 6 && data[9] != 3) || data[12] != 0)
+                    return "IHDR: unsupported format";
+                width = int(getU32(data));
+                height = int(getU32(data + 4));
+                channels = data[9] == 6 ? 4 : 1;
+            }
+            else if (type == "IDAT")
+                compressed.insert(compressed.end(), data, data + size);
+            else if (type == "IEND")
+                ended = true;
+
+            offset += 12 + size;
+        }
+
+        if (!ended)
+            return "no IEND chunk";
+        if (channels == 0)
+            return "no IHDR chunk";
+
+        auto const stride = size_t(width) * channels;
+        std::vector<uint8_t> raw((stride + 1) * height);
+        auto rawSize = uLongf(raw.size());
+        if (uncompress(raw.data(), &rawSize, compressed.data(), uLong(compressed.size())) != Z_OK || rawSize != raw.size())
+            return "IDAT: bad image data";
+
+        pixels.resize(stride * height);
+        for (int y = 0; y < height; y++)
+        {
+            auto const line = raw.data() + y * (stride + 1);
+            if (line[0] != 0)
+                return "unsupported scanline filter";
+            std::copy(line + 1, line + 1 + stride, pixels.begin() + y * stride);
+        }
+
+        return "";
+    }
+}
+
+// ========================================================================
+
+static std::unique_ptr<TileRegistry> createTileRegistry()
+{
+    auto tiles = std::make_unique<TileRegistry>();
+    tiles->registerTile(AIR, "blocks/air", BLACK);
+    tiles->registerTile(SOIL, "blocks/soil", DARKPURPLE);
+    tiles->registerTile(STONE, "blocks/stone", DARKBLUE);
+    tiles->registerTile(BACKGROUND, "blocks/background", DARKGRAY, Layer::BACKGROUND);
+    tiles->registerTile(WALL, "blocks/wall", LIGHTGRAY);
+    tiles->registerTile(CHAIN, "blocks/chain", LIME);
+
+    tiles->registerTile(STRUCTURE_VOID, "structure/void", RED);
+    tiles->registerTile(STRUCTURE_JOINT, "structure/joint", RED);
+
+    return tiles;
+}
+
+// usage: --export <png|png-indexed|rgba|indexed> <file|-> [seed]
+static int runExport(std::vector<std::string> const &args)
+{
+    Export::Format format;
+    if (args.size() < 3 || !Export::parseFormat(args[1], format))
+    {
+        std::cerr << "usage: --export <png|png-indexed|rgba|indexed> <file|-> [seed]" << std::endl;
+        return 1;
+    }
+
+    auto const seed = args.size() > 3 ? uint32_t(std::stoul(args[3])) : 0u;
+
+    auto const tiles = createTileRegistry();
+    auto const world = std::make_unique<World>();
+    auto const gen = std::make_unique<WorldGenerator>();
+    gen->generate(world.get(), tiles.get(), seed);
+
+    Export::FileSink sink(args[2]);
+    if (!sink.isOpen())
+    {
+        std::cerr << "unable to open '" << args[2] << "' for writing" << std::endl;
+        return 1;
+    }
+
+    if (!Export::writeWorld(world.get(), tiles.get(), format, &sink))
+    {
+        std::cerr << "failed to write the world to '" << args[2] << "'" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// writes both PNG formats to a temporary file, decodes them again and compares the pixels to the world
+// usage: --export-check [seed]
+static int runExportCheck(std::vector<std::string> const &args)
+{
+    auto const seed = args.size() > 1 ? uint32_t(std::stoul(args[1])) : 0u;
+
+    auto const tiles = createTileRegistry();
+    auto const world = std::make_unique<World>();
+    auto const gen = std::make_unique<WorldGenerator>();
+    gen->generate(world.get(), tiles.get(), seed);
+
+    auto failed = false;
+    for (auto const &[name, format] : {std::make_pair("png", Export::Format::PNG),
+                                       std::make_pair("png-indexed", Export::Format::PNG_INDEXED)})
+    {
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::tmpfile(), std::fclose);
+        if (!file)
+        {
+            std::cerr << "unable to create a temporary file" << std::endl;
+            return 1;
+        }
+
+        {
+#ifdef _WIN32
+            Export::FileSink sink(_fileno(file.get()));
+#else
+            Export::FileSink sink(fileno(file.get()));
+#endif
+            if (!Export::writeWorld(world.get(), tiles.get(), format, &sink))
+            {
+                std::cerr << name << ": failed to write" << std::endl;
+                return 1;
+            }
+        }
+
+        std::vector<uint8_t> bytes;
+        std::rewind(file.get());
+        uint8_t buffer[1 << 15];
+        for (size_t read; (read = std::fread(buffer, 1, sizeof(buffer), file.get())) > 0;)
+            bytes.insert(bytes.end(), buffer, buffer + read);
+
+        int width, height, channels;
+        std::vector<uint8_t> pixels;
+        auto error = Export::readPng(bytes, width, height, channels, pixels);
+
+        if (error.empty() && (width != WORLD_WIDTH || height != WORLD_HEIGHT))
+            error = "unexpected size " + std::to_string(width) + "x" + std::to_string(height);
+
+        // the image is top to bottom
+        for (int y = 0; error.empty() && y < WORLD_HEIGHT; y++)
+            for (int x = 0; x < WORLD_WIDTH; x++)
+            {
+                auto const tile = world->getTileAt(x, WORLD_HEIGHT_M1 - y);
+                auto const pixel = &pixels[(x + y * WORLD_WIDTH) * channels];
+                auto const color = tiles->getTileColor(tile);
+
+                if (channels == 1 ? pixel[0] != tile
+                                  : pixel[0] != color.r || pixel[1] != color.g || pixel[2] != color.b || pixel[3] != color.a)
+                {
+                    error = "pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") differs";
+                    break;
+                }
+            }
+
+        if (error.empty())
+            std::cout << "ok     " << name << " (" << bytes.size() << " bytes)" << std::endl;
+        else
+            std::cout << "FAILED " << name << ": " << error << std::endl;
+        failed |= !error.empty();
+    }
+
+    return failed ? 1 : 0;
+}
+
+// ========================================================================
+
+class BenchmarkSuite
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Result
+    {
+        std::string name;
+        int64_t iterations;
+        double minNs;
+        double medianNs;
+        double meanNs;
+        double itemsPerSecond;
+    };
+
+    static constexpr int REPETITIONS = 5;
+    static constexpr double REPETITION_TIME_MIN_NS = 50e6;
+
+    std::vector<Result> results;
+    std::string filter;
+
+    TileRegistry const *tileRegistry = nullptr;
+    std::unique_ptr<World> terrain = std::make_unique<World>();
+    std::unique_ptr<World> scratch = std::make_unique<World>();
+    std::unique_ptr<WorldGenerator> generator = std::make_unique<WorldGenerator>();
+
+    // keeps the optimizer from throwing away the measured work
+    static inline volatile float floatSink = 0;
+    static inline volatile bool boolSink = false;
+
+    // `setup` runs before every iteration and is excluded from the measurement
+    template <typename Setup, typename Body>
+    void run(std::string const &name, int64_t const itemsPerIteration, Setup &&setup, Body &&body)
+    {
+        if (!filter.empty() && name.find(filter) == std::string::npos)
+            return;
+
+        // returns the measured time, the wall time including the setup goes to `wall`
+        auto const measure = [&](int64_t const iterations, double &wall)
+        {
+            Clock::duration total{};
+            auto const wallStart = Clock::now();
+            for (int64_t i = 0; i < iterations; i++)
+            {
+                setup();
+                auto const start = Clock::now();
+                body();
+                total += Clock::now() - start;
+            }
+            wall = std::chrono::duration<double, std::nano>(Clock::now() - wallStart).count();
+            return std::chrono::duration<double, std::nano>(total).count();
+        };
+
+        // calibrate the iteration count so that one repetition is long enough to be stable,
+        // an expensive setup limits the count as well to keep the whole suite reasonably fast
+        int64_t iterations = 1;
+        double wall = 0;
+        for (auto elapsed = measure(1, wall); elapsed < REPETITION_TIME_MIN_NS && wall < REPETITION_TIME_MIN_NS * 4;)
+        {
+            auto const scale = REPETITION_TIME_MIN_NS / std::max(std::max(elapsed, wall / 4), 1.0);
+            iterations = std::min<int64_t>(std::max(iterations * 2, int64_t(iterations * scale)), 1 << 24);
+            elapsed = measure(iterations, wall);
+
+            if (iterations == 1 << 24)
+                break;
+        }
+
+        std::vector<double> samples;
+        for (int r = 0; r < REPETITIONS; r++)
+            samples.push_back(measure(iterations, wall) / iterations);
+        std::sort(samples.begin(), samples.end());
+
+        auto const mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+        auto const median = samples[samples.size() / 2];
+
+        results.push_back({name, iterations, samples.front(), median, mean, itemsPerIteration * 1e9 / median});
+        std::cerr << name << ": " << median << " ns" << std::endl;
+    }
+
+    template <typename Body>
+    void run(std::string const &name, int64_t const itemsPerIteration, Body &&body)
+    {
+        run(name, itemsPerIteration, [] {}, std::forward<Body>(body));
+    }
+
+    void benchmarkNoise()
+    {
+        constexpr int POINTS = 4096;
+
+        run("noise/noise3", POINTS, [&]
+            {
+                auto sum = 0.f;
+                for (int i = 0; i < POINTS; i++)
+                    sum += noise3(i / 64.f, (i & 63) / 16.f, 1.f);
+                floatSink = sum; });
+
+        for (int octaves = 1; octaves <= 3; octaves++)
+            run("noise/fractalNoise/octaves:" + std::to_string(octaves), POINTS, [&]
+                {
+                    auto sum = 0.f;
+                    for (int i = 0; i < POINTS; i++)
+                        sum += generator->fractalNoise(octaves, i / 64.f, (i & 63) / 16.f, 1.f);
+                    floatSink = sum; });
+
+        // the row-wise access pattern of genSoil: reference vs the specialized kernels
+        run("noise/noise3/fixed-yz", POINTS, [&]
+            {
+                auto sum = 0.f;
+                for (int i = 0; i < POINTS; i++)
+                    sum += noise3(i / 64.f, 0.75f, 1.f);
+                floatSink = sum; });
+
+        run("noise/Slice", POINTS, [&]
+            {
+                Noise::Slice const slice(0.75f, 1.f);
+                auto sum = 0.f;
+                for (int i = 0; i < POINTS; i++)
+                    sum += slice(i / 64.f);
+                floatSink = sum; });
+
+        run("noise/fractalNoise/octaves:3/fixed-yz", POINTS, [&]
+            {
+                auto sum = 0.f;
+                for (int i = 0; i < POINTS; i++)
+                    sum += generator->fractalNoise(3, i / 64.f, 0.75f, 1.f);
+                floatSink = sum; });
+
+        run("noise/Fractal<3>", POINTS, [&]
+            {
+                Noise::Fractal<3> const fractal(0.75f, 1.f);
+                auto sum = 0.f;
+                for (int i = 0; i < POINTS; i++)
+                    sum += fractal(i / 64.f);
+                floatSink = sum; });
+
+        run("noise/Fixed::Fractal<3>", POINTS, [&]
+            {
+                Noise::Fixed::Fractal<3> const fractal(Noise::Fixed::fromFloat(0.75f), Noise::Fixed::ONE);
+                int64_t sum = 0;
+                for (int i = 0; i < POINTS; i++)
+                    sum += fractal(int64_t(i) << (Noise::Fixed::SHIFT - 6));
+                floatSink = float(sum); });
+    }
+
+    void benchmarkTerrain()
+    {
+        generator->setNoiseMode(NoiseMode::FLOAT);
+        run(
+            "terrain/genSoil", WORLD_WIDTH * WORLD_HEIGHT,
+            [&]
+            { scratch->clear(); },
+            [&]
+            { generator->genSoil(scratch.get()); });
+
+        generator->setNoiseMode(NoiseMode::FIXED);
+        run(
+            "terrain/genSoil/fixed", WORLD_WIDTH * WORLD_HEIGHT,
+            [&]
+            { scratch->clear(); },
+            [&]
+            { generator->genSoil(scratch.get()); });
+        generator->setNoiseMode(DEFAULT_NOISE_MODE);
+    }
+
+    void benchmarkPlacement(std::vector<std::string> const &structureIds)
+    {
+        StructureProvider provider;
+        provider.attachTileRegistry(tileRegistry);
+
+        auto const builder = std::make_unique<StructureBuilder>();
+        builder->attachTileRegistry(tileRegistry);
+        builder->attachStructureProvider(&provider);
+        builder->attachWorld(terrain.get());
+
+        for (auto const &id : structureIds)
+        {
+            auto const obj = provider.getStructure(id);
+            auto const cells = int64_t(obj->width) * obj->height;
+
+            // somewhere below the surface in the middle of the world
+            auto const x = WORLD_WIDTH / 2 - obj->width / 2;
+            auto const y = WORLD_HEIGHT / 4;
+
+            // nothing around: only the broad phase runs
+            builder->reset();
+            run("builder/can_be_build/" + id, cells, [&]
+                { boolSink = builder->can_be_build(x, y, obj); });
+
+            // an overlapping neighbour with an empty obstruction map is the worst case: every cell gets tested
+            builder->transients->placedIndex.insert({x, y, obj->width, obj->height});
+            run("builder/can_be_build/" + id + "/narrow-phase", cells, [&]
+                { boolSink = builder->can_be_build(x, y, obj); });
+
+            run("builder/claimStructureSpace/" + id, cells, [&]
+                { builder->claimStructureSpace(x, y, obj); });
+
+            run("placement/underground/" + id, obj->width, [&]
+                { boolSink = undergroundPlacementChecker(terrain.get(), x, y, obj); });
+
+            // probe the sky so that the checker cannot leave early
+            auto const skyY = WORLD_HEIGHT_M1 - obj->height;
+            run("placement/no-blocks/" + id, cells, [&]
+                { boolSink = noBlocksPlacementChecker(terrain.get(), x, skyY, obj); });
+        }
+    }
+
+    void benchmarkJigsaw(std::vector<uint32_t> const &seeds)
+    {
+        for (auto const seed : seeds)
+            run(
+                "builder/processAllRequests/seed:" + std::to_string(seed), 1,
+                [&]
+                {
+                    *scratch = *terrain;
+                    generator->prepare(scratch.get(), tileRegistry, seed);
+                },
+                [&]
+                { generator->genBase(scratch.get()); });
+    }
+
+    void benchmarkRendering()
+    {
+        auto img = GenImageColor(WORLD_WIDTH, WORLD_HEIGHT, BLACK);
+
+        run("render/World::render", WORLD_WIDTH * WORLD_HEIGHT, [&]
+            { terrain->render(&img, tileRegistry); });
+
+        UnloadImage(img);
+    }
+
+    void benchmarkRegions()
+    {
+        constexpr int SIZE = 256;
+        std::vector<TileId> window(SIZE * SIZE);
+        auto const x = WORLD_WIDTH / 2 - SIZE / 2;
+        auto const y = WORLD_HEIGHT / 2 - SIZE / 2;
+
+        run(
+            "world/getTileAt/" + std::to_string(SIZE), SIZE * SIZE,
+            [&]
+            {
+                for (int j = 0; j < SIZE; j++)
+                    for (int i = 0; i < SIZE; i++)
+                        window[i + j * SIZE] = terrain->getTileAt(x + i, y + j);
+                boolSink = window.back() == AIR;
+            });
+
+        run(
+            "world/readRegion/" + std::to_string(SIZE), SIZE * SIZE,
+            [&]
+            {
+                terrain->readRegion(x, y, SIZE, SIZE, window.data(), SIZE);
+                boolSink = window.back() == AIR;
+            });
+
+        run(
+            "world/setTile/" + std::to_string(SIZE), SIZE * SIZE,
+            [&]
+            { *scratch = *terrain; },
+            [&]
+            {
+                for (int j = 0; j < SIZE; j++)
+                    for (int i = 0; i < SIZE; i++)
+                        scratch->setTile(x + i, y + j, window[i + j * SIZE]);
+            });
+
+        run(
+            "world/writeRegion/" + std::to_string(SIZE), SIZE * SIZE,
+            [&]
+            { *scratch = *terrain; },
+            [&]
+            { scratch->writeRegion(x, y, SIZE, SIZE, window.data(), SIZE); });
+    }
+
+    void benchmarkLighting()
+    {
+        constexpr int SIZE = 32;
+        Lighting::Scratch buffers;
+        auto const lit = std::make_unique<World>(*terrain);
+        Lighting::lightColumns(lit.get(), buffers, 0, WORLD_WIDTH);
+
+        run(
+            "light/lightColumns", WORLD_WIDTH * WORLD_HEIGHT,
+            [&]
+            { *scratch = *terrain; },
+            [&]
+            { Lighting::lightColumns(scratch.get(), buffers, 0, WORLD_WIDTH); });
+
+        // a room dug out next to the surface
+        auto const x = WORLD_WIDTH / 2 - SIZE / 2;
+        auto const y = lit->getHeightAt(WORLD_WIDTH / 2) - SIZE;
+
+        run(
+            "light/relight/" + std::to_string(SIZE), SIZE * SIZE,
+            [&]
+            {
+                *scratch = *lit;
+                scratch->fillRegion(x, y, SIZE, SIZE, AIR);
+            },
+            [&]
+            { Lighting::relight(scratch.get(), buffers, x, y, x + SIZE, y + SIZE); });
+    }
+
+    void benchmarkLoading(std::vector<std::string> const &structureIds)
+    {
+        std::unique_ptr<StructureProvider> provider;
+
+        run(
+            "provider/cold-load", int64_t(structureIds.size()),
+            [&]
+            {
+                provider = std::make_unique<StructureProvider>();
+                provider->attachTileRegistry(tileRegistry);
+            },
+            [&]
+            {
+                for (auto const &id : structureIds)
+                    provider->getStructure(id);
+            });
+    }
+
+public:
+    BenchmarkSuite(TileRegistry const *const registry, std::string nameFilter)
+        : filter(std::move(nameFilter)), tileRegistry(registry)
+    {
+        // the shared terrain is generated once
+        generator->genSoil(terrain.get());
+    }
+
+    void runAll()
+    {
+        std::vector<std::string> const structureIds = {
+            "room/base",
+            "shaft/horizontal",
+            "shaft/vertical",
+            "shaft/junction/all",
+            "shaft/end/top",
+            "misc/chain",
+        };
+
+        benchmarkNoise();
+        benchmarkTerrain();
+        benchmarkPlacement(structureIds);
+        benchmarkJigsaw({1, 2, 3, 42});
+        benchmarkRendering();
+        benchmarkRegions();
+        benchmarkLighting();
+        benchmarkLoading(structureIds);
+    }
+
+    // results are listed in a fixed order so that two runs can be diffed directly
+    nlohmann::json toJson() const
+    {
+        auto list = nlohmann::json::array();
+        for (auto const &r : results)
+            list.push_back({{"name", r.name},
+                            {"iterations", r.iterations},
+                            {"min_ns", r.minNs},
+                            {"median_ns", r.medianNs},
+                            {"mean_ns", r.meanNs},
+                            {"items_per_second", r.itemsPerSecond}});
+
+        return {{"version", 1},
+                {"repetitions", REPETITIONS},
+                {"benchmarks", list}};
+    }
+
+    // prints the median change of every benchmark present in both files, returns false on regressions
+    static bool compare(nlohmann::json const &baseline, nlohmann::json const &current, double const threshold)
+    {
+        std::unordered_map<std::string, double> before;
+        for (auto const &b : baseline.at("benchmarks"))
+            before[b.at("name").get<std::string>()] = b.at("median_ns").get<double>();
+
+        auto ok = true;
+        for (auto const &b : current.at("benchmarks"))
+        {
+            auto const name = b.at("name").get<std::string>();
+            auto const iter = before.find(name);
+            if (iter == before.cend())
+                continue;
+
+            auto const change = b.at("median_ns").get<double>() / iter->second - 1.0;
+            auto const regressed = change > threshold;
+            ok = ok && !regressed;
+
+            std::cout << (regressed ? "REGRESSED " : "          ") << name << ": "
+                      << (change >= 0 ? "+" : "") << change * 100.0 << "%" << std::endl;
+        }
+
+        return ok;
+    }
+};
+
+// usage: --bench [results.json] [name filter]
+//        --bench-compare <baseline.json> <current.json> [threshold, 0.1 = 10%]
+static int runBenchmarks(std::vector<std::string> const &args)
+{
+    if (args[0] == "--bench-compare")
+    {
+        if (args.size() < 3)
+        {
+            std::cerr << "usage: --bench-compare <baseline.json> <current.json> [threshold]" << std::endl;
+            return 1;
+        }
+
+        std::ifstream baseline(args[1]), current(args[2]);
+        auto const threshold = args.size() > 3 ? std::stod(args[3]) : 0.1;
+        return BenchmarkSuite::compare(nlohmann::json::parse(baseline), nlohmann::json::parse(current), threshold) ? 0 : 2;
+    }
+
+    auto const tiles = createTileRegistry();
+    BenchmarkSuite suite(tiles.get(), args.size() > 2 ? args[2] : "");
+    suite.runAll();
+
+    auto const json = suite.toJson().dump(4);
+    if (args.size() > 1 && args[1] != "-")
+    {
+        std::ofstream out(args[1]);
+        out << json << std::endl;
+        return out ? 0 : 1;
+    }
+
+    std::cout << json << std::endl;
+    return 0;
+}
+
+// ========================================================================
+
+namespace Golden
+{
+    // fixed set of seeds every output-affecting change is verified against
+    constexpr uint32_t SEEDS[] = {1, 2, 3, 42, 1337, 2024, 65535, 123456789};
+
+    struct Snapshot
+    {
+        struct Placement
+        {
+            std::string id;
+            int32_t x;
+            int32_t y;
+            int32_t cost;
+        };
+
+        uint32_t seed = 0;
+        NoiseMode noise = NoiseMode::FLOAT;
+        bool sampleSeeding = false; // res/seeding.sample.json instead of the single base
+        int siteWorkers = 0;        // not part of the result
+        std::vector<TileId> tiles;
+        std::vector<uint16_t> heights;
+        std::vector<Placement> placements;
+    };
+
+    static uint64_t fnv1a(void const *data, size_t const size, uint64_t hash = 14695981039346656037ull)
+    {
+        auto bytes = (uint8_t const *)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static std::string toHex(uint64_t const value)
+    {
+        char buffer[17];
+        snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+        return buffer;
+    }
+
+    // the seeds are checked with both noise modes, independent of the build's default
+    constexpr NoiseMode NOISE_MODES[] = {NoiseMode::FLOAT, NoiseMode::FIXED};
+
+    // the multi-site seeds are generated with different thread counts, every one has to match the same entry
+    constexpr int SITE_WORKERS[] = {1, 4};
+
+    static std::string describe(Snapshot const &snapshot)
+    {
+        auto description = "seed " + std::to_string(snapshot.seed) + (snapshot.noise == NoiseMode::FIXED ? " (fixed noise)" : "");
+        if (snapshot.sampleSeeding)
+            description += " (sample seeding, " + std::to_string(snapshot.siteWorkers) + " thread(s))";
+        return description;
+    }
+
+    static Configuration::Seeding loadSampleSeeding()
+    {
+        std::ifstream in("../../res/seeding.sample.json");
+        if (!in)
+            throw std::runtime_error("unable to read res/seeding.sample.json");
+        return nlohmann::json::parse(in).get<Configuration::Seeding>();
+    }
+
+    // with `seeding` the roots come from it instead of a single base
+    static Snapshot capture(uint32_t const seed, NoiseMode const noise, TileRegistry const *const registry,
+                            Configuration::Seeding const *const seeding = nullptr, int const siteWorkers = 0)
+    {
+        auto const world = std::make_unique<World>();
+        auto const gen = std::make_unique<WorldGenerator>();
+        gen->setNoiseMode(noise);
+        gen->setSeeding(seeding ? std::optional<Configuration::Seeding>(*seeding) : std::nullopt);
+        gen->setSiteWorkers(siteWorkers);
+        gen->generate(world.get(), registry, seed);
+
+        Snapshot snapshot;
+        snapshot.seed = seed;
+        snapshot.noise = noise;
+        snapshot.sampleSeeding = seeding != nullptr;
+        snapshot.siteWorkers = siteWorkers;
+
+        snapshot.tiles.resize(WORLD_WIDTH * WORLD_HEIGHT);
+        world->readRegion(0, 0, WORLD_WIDTH, WORLD_HEIGHT, snapshot.tiles.data(), WORLD_WIDTH);
+
+        int heights[WORLD_WIDTH];
+        world->getHeights(0, WORLD_WIDTH, heights);
+        snapshot.heights.assign(heights, heights + WORLD_WIDTH);
+
+        for (auto const &p : gen->getBuilder().getPlacements())
+            snapshot.placements.push_back({p.obj->id, p.x, p.y, p.cost});
+
+        return snapshot;
+    }
+
+    constexpr int RELIGHT_EDITS = 32;
+
+    // digs and fills rectangles around the surface of a generated world,
+    // the light after each relight() has to match lighting all columns again
+    static bool checkRelight(uint32_t const seed, TileRegistry const *const registry)
+    {
+        auto const world = std::make_unique<World>();
+        auto const gen = std::make_unique<WorldGenerator>();
+        gen->generate(world.get(), registry, seed);
+
+        Lighting::Scratch scratch;
+        auto const expected = std::make_unique<World>();
+        std::mt19937 rng(seed);
+
+        for (int edit = 0; edit < RELIGHT_EDITS; edit++)
+        {
+            auto const width = 1 + int(rng() % 32);
+            auto const height = 1 + int(rng() % 32);
+            auto const x = int(rng() % (WORLD_WIDTH - width));
+            auto const y = std::clamp(world->getHeightAt(x) - 16 + int(rng() % 48), 0, WORLD_HEIGHT - height);
+
+            world->fillRegion(x, y, width, height, rng() % 2 ? AIR : STONE);
+            Lighting::relight(world.get(), scratch, x, y, x + width, y + height);
+
+            *expected = *world;
+            Lighting::lightColumns(expected.get(), scratch, 0, WORLD_WIDTH);
+
+            for (int row = 0; row < WORLD_HEIGHT; row++)
+            {
+                auto const actual = world->getLightRow(row);
+                auto const mismatch = std::mismatch(actual, actual + WORLD_WIDTH, expected->getLightRow(row));
+                if (mismatch.first != actual + WORLD_WIDTH)
+                {
+                    std::cout << "seed " << seed << ": edit #" << edit << " leaves light " << int(*mismatch.first)
+                              << " instead of " << int(*mismatch.second) << " at (" << mismatch.first - actual
+                              << ", " << row << ")" << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    static uint64_t hashTiles(Snapshot const &snapshot)
+    {
+        auto const hash = fnv1a(snapshot.tiles.data(), snapshot.tiles.size() * sizeof(TileId));
+        return fnv1a(snapshot.heights.data(), snapshot.heights.size() * sizeof(uint16_t), hash);
+    }
+
+    static uint64_t hashPlacements(Snapshot const &snapshot)
+    {
+        auto hash = fnv1a(nullptr, 0);
+        for (auto const &p : snapshot.placements)
+        {
+            int32_t const values[] = {p.x, p.y, p.cost};
+            hash = fnv1a(p.id.data(), p.id.size(), hash);
+            hash = fnv1a(values, sizeof(values), hash);
+        }
+        return hash;
+    }
+
+    static nlohmann::json toJson(Snapshot const &snapshot)
+    {
+        nlohmann::json result = {{"seed", snapshot.seed},
+                                 {"tiles", toHex(hashTiles(snapshot))},
+                                 {"placements", toHex(hashPlacements(snapshot))},
+                                 {"pieces", snapshot.placements.size()}};
+        if (snapshot.noise == NoiseMode::FIXED)
+            result["noise"] = "fixed";
+        if (snapshot.sampleSeeding)
+            result["seeding"] = "sample";
+        return result;
+    }
+
+    // full snapshots for comparing two different builds cell by cell
+    static bool writeDump(std::string const &path, std::vector<Snapshot> const &snapshots)
+    {
+        std::ofstream out(path, std::ios::binary);
+
+        auto const put = [&](auto const value)
+        { out.write((char const *)&value, sizeof(value)); };
+
+        put(uint32_t(snapshots.size()));
+        put(uint32_t(WORLD_WIDTH));
+        put(uint32_t(WORLD_HEIGHT));
+
+        for (auto const &snapshot : snapshots)
+        {
+            put(snapshot.seed);
+            put(uint8_t(snapshot.noise));
+            put(uint8_t(snapshot.sampleSeeding));
+            out.write((char const *)snapshot.tiles.data(), snapshot.tiles.size() * sizeof(TileId));
+            out.write((char const *)snapshot.heights.data(), snapshot.heights.size() * sizeof(uint16_t));
+
+            put(uint32_t(snapshot.placements.size()));
+            for (auto const &p : snapshot.placements)
+            {
+                put(uint32_t(p.id.size()));
+                out.write(p.id.data(), p.id.size());
+                put(p.x);
+                put(p.y);
+                put(p.cost);
+            }
+        }
+
+        return bool(out);
+    }
+
+    static bool readDump(std::string const &path, std::vector<Snapshot> &snapshots)
+    {
+        std::ifstream in(path, std::ios::binary);
+
+        auto const get = [&](auto &value)
+        { in.read((char *)&value, sizeof(value)); };
+
+        uint32_t count = 0, width = 0, height = 0;
+        get(count);
+        get(width);
+        get(height);
+
+        if (!in || width != WORLD_WIDTH || height != WORLD_HEIGHT)
+            return false;
+
+        snapshots.resize(count);
+        for (auto &snapshot : snapshots)
+        {
+            get(snapshot.seed);
+            uint8_t noise = 0;
+            get(noise);
+            snapshot.noise = NoiseMode(noise);
+            uint8_t sampleSeeding = 0;
+            get(sampleSeeding);
+            snapshot.sampleSeeding = sampleSeeding != 0;
+            snapshot.tiles.resize(WORLD_WIDTH * WORLD_HEIGHT);
+            snapshot.heights.resize(WORLD_WIDTH);
+            in.read((char *)snapshot.tiles.data(), snapshot.tiles.size() * sizeof(TileId));
+            in.read((char *)snapshot.heights.data(), snapshot.heights.size() * sizeof(uint16_t));
+
+            uint32_t placements = 0;
+            get(placements);
+            snapshot.placements.resize(placements);
+            for (auto &p : snapshot.placements)
+            {
+                uint32_t length = 0;
+                get(length);
+                p.id.resize(length);
+                in.read(p.id.data(), length);
+                get(p.x);
+                get(p.y);
+                get(p.cost);
+            }
+        }
+
+        return bool(in);
+    }
+
+    // reports the first differing cell, height and placement, returns true if both are identical
+    static bool diff(Snapshot const &a, Snapshot const &b)
+    {
+        auto same = true;
+
+        for (size_t i = 0; i < a.tiles.size(); i++)
+            if (a.tiles[i] != b.tiles[i])
+            {
+                std::cout << describe(a) << ": first differing cell at (" << i % WORLD_WIDTH << ", " << i / WORLD_WIDTH
+                          << "): " << int(a.tiles[i]) << " vs " << int(b.tiles[i]) << std::endl;
+                same = false;
+                break;
+            }
+
+        for (size_t x = 0; x < a.heights.size(); x++)
+            if (a.heights[x] != b.heights[x])
+            {
+                std::cout << describe(a) << ": first differing height at x = " << x
+                          << ": " << a.heights[x] << " vs " << b.heights[x] << std::endl;
+                same = false;
+                break;
+            }
+
+        auto const common = std::min(a.placements.size(), b.placements.size());
+        for (size_t i = 0; i <= common; i++)
+        {
+            if (i == common)
+            {
+                if (a.placements.size() != b.placements.size())
+                {
+                    std::cout << describe(a) << ": placement count " << a.placements.size()
+                              << " vs " << b.placements.size() << std::endl;
+                    same = false;
+                }
+                break;
+            }
+
+            auto const &pa = a.placements[i];
+            auto const &pb = b.placements[i];
+            if (pa.id != pb.id || pa.x != pb.x || pa.y != pb.y || pa.cost != pb.cost)
+            {
+                std::cout << describe(a) << ": first differing placement #" << i << ": "
+                          << pa.id << " at (" << pa.x << ", " << pa.y << ") vs "
+                          << pb.id << " at (" << pb.x << ", " << pb.y << ")" << std::endl;
+                same = false;
+                break;
+            }
+        }
+
+        return same;
+    }
+}
+
+// usage: --golden record [golden.json]
+//        --golden check [golden.json]
+//        --golden dump <snapshots.bin>
+//        --golden diff <snapshots-a.bin> <snapshots-b.bin>
+static int runGolden(std::vector<std::string> const &args)
+{
+    auto const mode = args.size() > 1 ? args[1] : "";
+    auto const goldenPath = args.size() > 2 ? args[2] : "../../res/golden.json";
+
+    auto const tiles = createTileRegistry();
+
+    auto const captureAll = [&]
+    {
+        std::vector<Golden::Snapshot> snapshots;
+        for (auto const noise : Golden::NOISE_MODES)
+            for (auto const seed : Golden::SEEDS)
+                snapshots.push_back(Golden::capture(seed, noise, tiles.get()));
+
+        auto const seeding = Golden::loadSampleSeeding();
+        for (auto const workers : Golden::SITE_WORKERS)
+            for (auto const seed : Golden::SEEDS)
+                snapshots.push_back(Golden::capture(seed, NoiseMode::FLOAT, tiles.get(), &seeding, workers));
+        return snapshots;
+    };
+
+    // seed, noise mode and seeding of an entry
+    auto const keyOf = [](nlohmann::json const &entry)
+    {
+        return std::make_tuple(entry.at("seed").get<uint32_t>(), entry.value("noise", "float"), entry.value("seeding", ""));
+    };
+
+    if (mode == "record")
+    {
+        // the thread counts of the multi-site seeds have to agree before anything is recorded
+        std::map<std::tuple<uint32_t, std::string, std::string>, nlohmann::json> recorded;
+        auto list = nlohmann::json::array();
+        for (auto const &snapshot : captureAll())
+        {
+            auto const entry = Golden::toJson(snapshot);
+            if (auto const [iter, inserted] = recorded.emplace(keyOf(entry), entry); !inserted)
+            {
+                if (iter->second != entry)
+                {
+                    std::cerr << Golden::describe(snapshot) << " differs from another thread count" << std::endl;
+                    return 2;
+                }
+                continue;
+            }
+            list.push_back(entry);
+        }
+
+        std::ofstream out(goldenPath);
+        out << nlohmann::json{{"seeds", list}}.dump(4) << std::endl;
+        return out ? 0 : 1;
+    }
+
+    if (mode == "check")
+    {
+        std::ifstream in(goldenPath);
+        if (!in)
+        {
+            std::cerr << "unable to read '" << goldenPath << "'" << std::endl;
+            return 1;
+        }
+
+        auto const golden = nlohmann::json::parse(in);
+
+        std::map<std::tuple<uint32_t, std::string, std::string>, nlohmann::json> expected;
+        for (auto const &entry : golden.at("seeds"))
+            expected[keyOf(entry)] = entry;
+
+        auto failures = 0;
+        std::set<std::tuple<uint32_t, std::string, std::string>> matched;
+        for (auto const &snapshot : captureAll())
+        {
+            auto const actual = Golden::toJson(snapshot);
+            auto const iter = expected.find(keyOf(actual));
+            auto const ok = iter != expected.cend() && iter->second == actual;
+            failures += !ok;
+            if (iter != expected.cend())
+                matched.insert(iter->first);
+
+            std::cout << (ok ? "ok     " : "FAILED ") << Golden::describe(snapshot)
+                      << ": tiles " << actual["tiles"].get<std::string>()
+                      << ", placements " << actual["placements"].get<std::string>() << std::endl;
+        }
+
+        // entries of the file nothing was captured for, e.g. a seed removed from Golden::SEEDS
+        for (auto const &[key, entry] : expected)
+            if (!matched.count(key))
+            {
+                failures++;
+                std::cout << "MISSING " << entry.dump() << std::endl;
+            }
+
+        for (auto const seed : Golden::SEEDS)
+        {
+            auto const ok = Golden::checkRelight(seed, tiles.get());
+            failures += !ok;
+            std::cout << (ok ? "ok     " : "FAILED ") << "seed " << seed << ": relight of "
+                      << Golden::RELIGHT_EDITS << " edits" << std::endl;
+        }
+
+        return failures == 0 ? 0 : 2;
+    }
+
+    if (mode == "dump" && args.size() > 2)
+        return Golden::writeDump(args[2], captureAll()) ? 0 : 1;
+
+    if (mode == "diff" && args.size() > 3)
+    {
+        std::vector<Golden::Snapshot> a, b;
+        if (!Golden::readDump(args[2], a) || !Golden::readDump(args[3], b))
+        {
+            std::cerr << "unable to read the snapshots" << std::endl;
+            return 1;
+        }
+
+        if (a.size() != b.size())
+        {
+            std::cout << "snapshot count " << a.size() << " vs " << b.size() << std::endl;
+            return 2;
+        }
+
+        auto same = true;
+        for (size_t i = 0; i < a.size(); i++)
+            same = Golden::diff(a[i], b[i]) && same;
+
+        if (same)
+            std::cout << "identical" << std::endl;
+        return same ? 0 : 2;
+    }
+
+    std::cerr << "usage: --golden <record|check> [golden.json]" << std::endl
+              << "       --golden dump <snapshots.bin>" << std::endl
+              << "       --golden diff <snapshots-a.bin> <snapshots-b.bin>" << std::endl;
+    return 1;
+}
+
+// usage: --pipeline [seed] [runs]
+// prints the stage schedule with the timings of the last run
+static int runPipeline(std::vector<std::string> const &args)
+{
+    auto const seed = args.size() > 1 ? uint32_t(std::stoul(args[1])) : 0u;
+    auto const runs = args.size() > 2 ? std::stoi(args[2]) : 1;
+
+    auto const tiles = createTileRegistry();
+    auto const world = std::make_unique<World>();
+    auto const gen = std::make_unique<WorldGenerator>();
+    for (int i = 0; i < runs; i++)
+    {
+        world->clear();
+        gen->generate(world.get(), tiles.get(), seed);
+    }
+
+    for (auto const &timing : gen->getStageTimings())
+    {
+        std::cout << "wave " << timing.wave << "  " << timing.name << ": ";
+        if (timing.tasks == 0)
+            std::cout << "cached" << std::endl;
+        else
+            std::cout << timing.wallMs << " ms (" << timing.busyMs << " ms in " << timing.tasks << " task(s))"
+                      << std::endl;
+    }
+
+    return 0;
+}
+
+// usage: --check-assets [structure id ...]
+// loads the structures reachable from the given roots (room/base by default) and lists the asset warnings,
+// a structure that fails to load is an error
+static int runCheckAssets(std::vector<std::string> const &args)
+{
+    std::vector<std::string> roots(args.begin() + 1, args.end());
+    if (roots.empty())
+        roots.push_back("room/base");
+
+    auto const tiles = createTileRegistry();
+    StructureProvider provider;
+    provider.attachTileRegistry(tiles.get());
+
+    std::vector<std::string> errors;
+    for (auto const &root : roots)
+    {
+        try
+        {
+            provider.preload(root);
+        }
+        catch (std::exception const &e)
+        {
+            errors.push_back(e.what());
+        }
+    }
+
+    for (auto const &error : errors)
+        std::cout << "error: " << error << std::endl;
+    for (auto const &warning : provider.getWarnings())
+        std::cout << "warning: " << warning << std::endl;
+    std::cout << errors.size() << " error(s), " << provider.getWarnings().size() << " warning(s)" << std::endl;
+
+    return errors.empty() ? 0 : 1;
+}
+
+// ========================================================================
+
+// Synthetic structure libraries, much larger than res/, to see how the builder scales
+namespace Stress
+{
+    struct Options
+    {
+        int pieces = 1000;  // in the library
+        int minSize = 3;    // side of a piece, walls included
+        int maxSize = 9;
+        int joints = 4;     // per piece, spread over the four sides
+        int fanOut = 8;     // targets per joint
+        float skew = 1.f;   // the weight of the n-th target is 1000 / n^skew, 0 - uniform
+        float rejection = 0.1f; // share of the placements a constraint rejects
+        int maxCost = 256;  // the cost limit is doubled up to this
+        int seeds = 3;      // runs per cost limit
+    };
+
+    static bool parseOption(Options &options, std::string const &arg)
+    {
+        auto const eq = arg.find('=');
+        if (eq == std::string::npos)
+            return false;
+
+        auto const name = arg.substr(0, eq);
+        auto const value = arg.substr(eq + 1);
+
+        static std::unordered_map<std::string, int Options::*> const ints = {
+            {"pieces", &Options::pieces},
+            {"min-size", &Options::minSize},
+            {"max-size", &Options::maxSize},
+            {"joints", &Options::joints},
+            {"fan-out", &Options::fanOut},
+            {"max-cost", &Options::maxCost},
+            {"seeds", &Options::seeds},
+        };
+        static std::unordered_map<std::string, float Options::*> const floats = {
+            {"skew", &Options::skew},
+            {"rejection", &Options::rejection},
+        };
+
+        if (auto const iter = ints.find(name); iter != ints.cend())
+            options.*(iter->second) = std::stoi(value);
+        else if (auto const iter = floats.find(name); iter != floats.cend())
+            options.*(iter->second) = std::stof(value);
+        else
+            return false;
+
+        return true;
+    }
+
+    // a checker can't carry state, the harness is single-threaded
+    static uint64_t rejectionThreshold = 0; // rejected share * 2^32
+
+    // rejects a fixed share of the (position, piece) pairs, the same ones on every run
+    static bool rejectionChecker(World const *, int const x, int const y, StructureObject const *const obj)
+    {
+        // FNV-1a of the id, addresses change from run to run
+        auto id = 2166136261u;
+        for (auto const c : obj->id)
+            id = (id ^ uint8_t(c)) * 16777619u;
+
+        auto hash = uint32_t(x) * 0x9E3779B1u ^ uint32_t(y) * 0x85EBCA77u ^ id * 0xC2B2AE3Du;
+        hash ^= hash >> 15;
+        hash *= 0x2C1B3C6Du;
+        hash ^= hash >> 12;
+        return hash >= rejectionThreshold;
+    }
+
+    // the side a joint faces: 0 - left, 1 - right, 2 - top, 3 - bottom
+    static constexpr int OPPOSITE[4] = {1, 0, 3, 2};
+
+    // registers "stress/0" ... "stress/<pieces - 1>": walls around a background, joints in the walls
+    static void generateLibrary(StructureProvider &provider, Options const &options, uint32_t const seed)
+    {
+        std::mt19937 rng(seed);
+        auto const size = [&]
+        { return options.minSize + int(rng() % uint32_t(options.maxSize - options.minSize + 1)); };
+
+        struct Piece
+        {
+            int width;
+            int height;
+            std::vector<std::pair<std::string, int>> joints; // name, side
+        };
+
+        std::vector<Piece> pieces(options.pieces);
+        for (auto &piece : pieces)
+        {
+            piece.width = size();
+            piece.height = size();
+            for (int j = 0; j < options.joints; j++)
+                piece.joints.emplace_back("#" + std::to_string(j), j % 4);
+        }
+
+        for (int i = 0; i < options.pieces; i++)
+        {
+            auto const &piece = pieces[i];
+            auto const w = piece.width, h = piece.height;
+
+            Configuration::Structure config;
+            config.cost = 1;
+            config.placementConstraints = {"no-blocks", "stress/reject"};
+
+            // bottom to top
+            std::vector<TileId> tiles(w * h, BACKGROUND);
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                    if (x == 0 || y == 0 || x == w - 1 || y == h - 1)
+                        tiles[x + y * w] = WALL;
+
+            for (auto const &[name, side] : piece.joints)
+            {
+                // image coordinates (y goes down) like in res/, away from the corners
+                auto const along = 1 + int(rng() % uint32_t(std::max(1, (side < 2 ? h : w) - 2)));
+                std::array<uint16_t, 2> location;
+                std::array<int16_t, 2> direction;
+                switch (side)
+                {
+                case 0:
+                    location = {0, uint16_t(along)};
+                    direction = {-1, 0};
+                    break;
+                case 1:
+                    location = {uint16_t(w - 1), uint16_t(along)};
+                    direction = {1, 0};
+                    break;
+                case 2:
+                    location = {uint16_t(along), 0};
+                    direction = {0, 1};
+                    break;
+                default:
+                    location = {uint16_t(along), uint16_t(h - 1)};
+                    direction = {0, -1};
+                    break;
+                }
+
+                // several joints on a side may share a cell, the first one wins
+                auto &cell = tiles[location[0] + (h - 1 - location[1]) * w];
+                if (cell == STRUCTURE_JOINT)
+                    continue;
+                cell = STRUCTURE_JOINT;
+
+                Configuration::Structure::Joint joint;
+                joint.location = location;
+                joint.direction = direction;
+                joint.replaceBy = "blocks/background";
+
+                // random pieces with a joint facing back
+                for (int attempt = 0; int(joint.structures.size()) < options.fanOut && attempt < options.fanOut * 4; attempt++)
+                {
+                    auto const target = int(rng() % uint32_t(options.pieces));
+                    for (auto const &[targetName, targetSide] : pieces[target].joints)
+                        if (targetSide == OPPOSITE[side])
+                        {
+                            auto const rank = float(joint.structures.size() + 1);
+                            auto const weight = int32_t(std::max(1.f, 1000.f / std::pow(rank, options.skew)));
+                            joint.structures.push_back({"stress/" + std::to_string(target), targetName, weight});
+                            break;
+                        }
+                }
+
+                config.joints.emplace(name, std::move(joint));
+            }
+
+            provider.registerStructure("stress/" + std::to_string(i), w, h, std::move(config), std::move(tiles));
+        }
+    }
+}
+
+// usage: --stress <results.csv|-> [name=value ...], see Stress::Options for the names
+// one CSV line per cost limit and seed: placed pieces against time and memory
+static int runStress(std::vector<std::string> const &args)
+{
+    Stress::Options options;
+    auto valid = args.size() >= 2;
+    for (size_t i = 2; valid && i < args.size(); i++)
+        valid = Stress::parseOption(options, args[i]);
+
+    if (!valid || options.pieces < 1 || options.joints < 1 || options.minSize < 3 ||
+        options.maxSize < options.minSize || options.maxSize > 255)
+    {
+        std::cerr << "usage: --stress <results.csv|-> [pieces=N] [min-size=N] [max-size=N] [joints=N] [fan-out=N]"
+                     " [skew=F] [rejection=F] [max-cost=N] [seeds=N]"
+                  << std::endl;
+        return 1;
+    }
+
+    Stress::rejectionThreshold = uint64_t(double(std::clamp(options.rejection, 0.f, 1.f)) * 4294967296.);
+
+    auto const tiles = createTileRegistry();
+    StructureProvider provider;
+    provider.attachTileRegistry(tiles.get());
+    Stress::generateLibrary(provider, options, 1);
+
+    auto const world = std::make_unique<World>();
+    auto const builder = std::make_unique<StructureBuilder>();
+    builder->attachTileRegistry(tiles.get());
+    builder->attachStructureProvider(&provider);
+    builder->attachWorld(world.get());
+
+    std::ofstream file;
+    if (args[1] != "-")
+    {
+        file.open(args[1]);
+        if (!file)
+        {
+            std::cerr << "unable to open '" << args[1] << "' for writing" << std::endl;
+            return 1;
+        }
+    }
+    auto &out = args[1] == "-" ? std::cout : file;
+    out << "cost_limit,seed,pieces,time_ms,ns_per_piece,arena_bytes,arena_overflows,complexes,dangling_joints" << std::endl;
+
+    for (int limit = 1; limit <= options.maxCost; limit *= 2)
+        for (int seed = 0; seed < options.seeds; seed++)
+        {
+            world->clear();
+            builder->reset();
+            builder->seed(uint32_t(seed));
+            builder->setCostLimit(limit);
+
+            // the root is the first piece in the middle of the world, only the pieces after it may be rejected
+            auto const start = std::chrono::steady_clock::now();
+            builder->registerPlacementChecker("stress/reject", [](World const *, int, int, StructureObject const *)
+                                              { return true; });
+            builder->requestStructureAt(WORLD_WIDTH / 2, WORLD_HEIGHT / 2, "stress/0", "#0", 0);
+            builder->registerPlacementChecker("stress/reject", Stress::rejectionChecker);
+            builder->processAllRequests();
+            auto const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            auto const pieces = builder->getPlacements().size();
+            out << limit << ',' << seed << ',' << pieces << ',' << ms << ',' << ms * 1e6 / double(std::max<size_t>(pieces, 1))
+                << ',' << builder->getArena().getFootprint() << ',' << builder->getArena().getOverflows()
+                << ',' << builder->getComplexes().getCount() << ',' << builder->getDanglingJoints().size() << std::endl;
+        }
+
+    return out ? 0 : 1;
+}
+
+// ========================================================================
+
+#ifndef _WIN32
+// Generation service over a Unix domain socket, one JSON request per line:
+//   {"seed": 42, "terrain-seed": 1, "format": "indexed", "noise": "fixed"}
+//                                                         -> {"status": "ok", ..., "bytes": N} line + N bytes of tiles
+//   {"stats": true}                                       -> {"served": ..., "queue-depth": ..., "p50-ms": ..., ...}
+//   {"shutdown": true}                                    -> {"status": "ok"}, the server exits
+namespace Service
+{
+    using Clock = std::chrono::steady_clock;
+
+    // buffered reading of lines and raw bytes from a socket
+    class Connection
+    {
+    private:
+        int fd;
+        std::vector<char> buffer;
+        size_t begin = 0;
+        size_t end = 0;
+
+        bool fill()
+        {
+            if (begin == end)
+                begin = end = 0;
+            if (end == buffer.size())
+                buffer.resize(buffer.size() * 2);
+
+            auto const received = ::read(fd, buffer.data() + end, buffer.size() - end);
+            if (received <= 0)
+                return false;
+
+            end += received;
+            return true;
+        }
+
+    public:
+        explicit Connection(int const descriptor) : fd(descriptor), buffer(1 << 16) {}
+
+        int getFd() const
+        {
+            return fd;
+        }
+
+        bool readLine(std::string &line)
+        {
+            for (;;)
+            {
+                auto const first = buffer.cbegin() + begin;
+                auto const last = buffer.cbegin() + end;
+                if (auto const newline = std::find(first, last, '\n'); newline != last)
+                {
+                    line.assign(first, newline);
+                    begin += newline - first + 1;
+                    return true;
+                }
+
+                if (!fill())
+                    return false;
+            }
+        }
+
+        bool readBytes(void *const data, size_t const size)
+        {
+            auto out = (char *)data;
+            auto remaining = size;
+
+            while (remaining > 0)
+            {
+                if (begin == end && !fill())
+                    return false;
+
+                auto const chunk = std::min(remaining, end - begin);
+                std::copy(buffer.data() + begin, buffer.data() + begin + chunk, out);
+                begin += chunk;
+                out += chunk;
+                remaining -= chunk;
+            }
+
+            return true;
+        }
+
+        bool writeLine(nlohmann::json const &message)
+        {
+            auto const text = message.dump() + "\n";
+            return Export::FileSink(fd).write(text.data(), text.size());
+        }
+    };
+
+    int connectTo(std::string const &path)
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            return -1;
+        std::copy(path.cbegin(), path.cend(), address.sun_path);
+
+        auto const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr const *)&address, sizeof(address)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    class Server
+    {
+    private:
+        struct Job
+        {
+            uint32_t seed;
+            int terrainSeed;
+            NoiseMode noise;
+            Export::Format format;
+            Connection *connection;
+            Clock::time_point queued;
+            std::promise<void> done;
+        };
+
+        TileRegistry const *tileRegistry;
+        int listenFd = -1;
+        std::atomic<bool> stopping{false};
+
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        std::deque<Job *> queue;
+        std::unordered_set<int> connections;
+
+        // connection threads that are about to return, joined by the accepting thread
+        std::vector<std::thread::id> finishedClients;
+
+        // end-to-end latencies of the last requests, a ring buffer
+        static constexpr size_t LATENCY_WINDOW = 4096;
+        std::vector<double> latencies;
+        size_t served = 0;
+        size_t maxQueueDepth = 0;
+
+        void work()
+        {
+            // every worker has its own generator, warmed up before the first request
+            auto const generator = std::make_unique<WorldGenerator>();
+            auto const world = std::make_unique<World>();
+            generator->generate(world.get(), tileRegistry, 0);
+
+            for (;;)
+            {
+                Job *job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wakeUp.wait(lock, [this]() { return stopping || !queue.empty(); });
+                    if (queue.empty())
+                        return;
+
+                    job = queue.front();
+                    queue.pop_front();
+                }
+
+                auto const start = Clock::now();
+                world->clear();
+                generator->setTerrainSeed(job->terrainSeed);
+                generator->setNoiseMode(job->noise);
+                generator->generate(world.get(), tileRegistry, job->seed);
+                auto const generated = Clock::now();
+
+                auto const &builder = generator->getBuilder();
+                auto const bytes = size_t(WORLD_WIDTH) * WORLD_HEIGHT *
+                                   (job->format == Export::Format::RGBA ? sizeof(Color) : sizeof(TileId));
+
+                job->connection->writeLine({
+                    {"status", "ok"},
+                    {"seed", job->seed},
+                    {"width", WORLD_WIDTH},
+                    {"height", WORLD_HEIGHT},
+                    {"queued-ms", std::chrono::duration<double, std::milli>(start - job->queued).count()},
+                    {"generate-ms", std::chrono::duration<double, std::milli>(generated - start).count()},
+                    {"pieces", builder.getPlacements().size()},
+                    {"complexes", builder.getComplexes().getCount()},
+                    {"dangling-joints", builder.getDanglingJoints().size()},
+                    {"bytes", bytes},
+                });
+
+                Export::FileSink sink(job->connection->getFd());
+                Export::writeWorld(world.get(), tileRegistry, job->format, &sink);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto const latency = std::chrono::duration<double, std::milli>(Clock::now() - job->queued).count();
+                    if (latencies.size() < LATENCY_WINDOW)
+                        latencies.push_back(latency);
+                    else
+                        latencies[served % LATENCY_WINDOW] = latency;
+                    served++;
+                }
+
+                job->done.set_value();
+            }
+        }
+
+        nlohmann::json getStats()
+        {
+            std::vector<double> sorted;
+            nlohmann::json stats;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                sorted = latencies;
+                stats["served"] = served;
+                stats["queue-depth"] = queue.size();
+                stats["max-queue-depth"] = maxQueueDepth;
+            }
+
+            auto const percentile = [&](double const p)
+            {
+                if (sorted.empty())
+                    return 0.;
+
+                auto const nth = sorted.begin() + size_t(p * (sorted.size() - 1));
+                std::nth_element(sorted.begin(), nth, sorted.end());
+                return *nth;
+            };
+
+            stats["p50-ms"] = percentile(0.5);
+            stats["p99-ms"] = percentile(0.99);
+            return stats;
+        }
+
+        // the message of the first field with a wrong type, empty when the request is fine
+        static std::string validate(nlohmann::json const &request)
+        {
+            if (!request.is_object())
+                return "a request has to be an object";
+
+            for (auto const &[key, value] : request.items())
+            {
+                if ((key == "stats" || key == "shutdown") && !value.is_boolean())
+                    return "'" + key + "' has to be a boolean";
+                if ((key == "format" || key == "noise") && !value.is_string())
+                    return "'" + key + "' has to be a string";
+                if (key == "seed" && !(value.is_number_unsigned() && value.get<uint64_t>() <= UINT32_MAX))
+                    return "'seed' has to be an unsigned 32-bit integer";
+                if (key == "terrain-seed" &&
+                    !(value.is_number_integer() && value.get<int64_t>() >= INT32_MIN && value.get<int64_t>() <= INT32_MAX))
+                    return "'terrain-seed' has to be a 32-bit integer";
+            }
+
+            return "";
+        }
+
+        void serve(int const fd)
+        {
+            Connection connection(fd);
+            std::string line;
+
+            while (!stopping && connection.readLine(line))
+            {
+                // nothing a client sends may take the server down
+                nlohmann::json request;
+                std::string error;
+                try
+                {
+                    request = nlohmann::json::parse(line);
+                    error = validate(request);
+                }
+                catch (nlohmann::json::exception const &e)
+                {
+                    error = e.what();
+                }
+
+                if (!error.empty())
+                {
+                    connection.writeLine({{"status", "error"}, {"message", error}});
+                    continue;
+                }
+
+                if (request.value("stats", false))
+                {
+                    connection.writeLine(getStats());
+                    continue;
+                }
+
+                if (request.value("shutdown", false))
+                {
+                    connection.writeLine({{"status", "ok"}});
+                    stop();
+                    break;
+                }
+
+                auto format = Export::Format::INDEXED;
+                auto const formatName = request.value("format", std::string("indexed"));
+                if (!Export::parseFormat(formatName, format) ||
+                    (format != Export::Format::INDEXED && format != Export::Format::RGBA))
+                {
+                    connection.writeLine({{"status", "error"}, {"message", "unsupported format '" + formatName + "'"}});
+                    continue;
+                }
+
+                auto noise = DEFAULT_NOISE_MODE;
+                if (auto const iter = request.find("noise"); iter != request.end() && !parseNoiseMode(iter->get<std::string>(), noise))
+                {
+                    connection.writeLine({{"status", "error"}, {"message", "unsupported noise " + iter->dump()}});
+                    continue;
+                }
+
+                Job job;
+                job.seed = request.value("seed", 0u);
+                job.terrainSeed = request.value("terrain-seed", 1);
+                job.noise = noise;
+                job.format = format;
+                job.connection = &connection;
+                job.queued = Clock::now();
+                auto done = job.done.get_future();
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(&job);
+                    maxQueueDepth = std::max(maxQueueDepth, queue.size());
+                }
+                wakeUp.notify_one();
+
+                // the worker writes the response, the next request may only be read afterwards
+                done.wait();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            connections.erase(fd);
+            close(fd);
+            finishedClients.push_back(std::this_thread::get_id());
+        }
+
+        void stop()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+
+            // unblock accept() and the connections waiting for requests
+            ::shutdown(listenFd, SHUT_RDWR);
+            for (auto const fd : connections)
+                ::shutdown(fd, SHUT_RD);
+
+            wakeUp.notify_all();
+        }
+
+    public:
+        explicit Server(TileRegistry const *const registry) : tileRegistry(registry) {}
+
+        int run(std::string const &path, int const workerCount)
+        {
+            // a client going away must not kill the server
+            std::signal(SIGPIPE, SIG_IGN);
+
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+            {
+                std::cerr << "socket path too long" << std::endl;
+                return 1;
+            }
+            std::copy(path.cbegin(), path.cend(), address.sun_path);
+
+            unlink(path.c_str());
+            listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listenFd < 0 ||
+                bind(listenFd, (sockaddr const *)&address, sizeof(address)) != 0 ||
+                listen(listenFd, 64) != 0)
+            {
+                std::cerr << "unable to listen on '" << path << "'" << std::endl;
+                return 1;
+            }
+
+            std::vector<std::thread> workers;
+            for (int i = 0; i < workerCount; i++)
+                workers.emplace_back(&Server::work, this);
+
+            std::cerr << "serving on " << path << " with " << workerCount << " worker(s)" << std::endl;
+
+            std::vector<std::thread> clients;
+            while (!stopping)
+            {
+                auto const fd = accept(listenFd, nullptr, nullptr);
+                if (fd < 0)
+                    continue;
+
+                std::vector<std::thread> finished;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (stopping)
+                    {
+                        close(fd);
+                        break;
+                    }
+
+                    // the threads of closed connections are only returning, they are joined right away
+                    for (auto const id : finishedClients)
+                    {
+                        auto const iter = std::find_if(clients.begin(), clients.end(),
+                                                       [id](std::thread const &client) { return client.get_id() == id; });
+                        finished.push_back(std::move(*iter));
+                        clients.erase(iter);
+                    }
+                    finishedClients.clear();
+
+                    connections.insert(fd);
+                    clients.emplace_back(&Server::serve, this, fd);
+                }
+
+                for (auto &client : finished)
+                    client.join();
+            }
+
+            for (auto &client : clients)
+                client.join();
+            for (auto &worker : workers)
+                worker.join();
+
+            close(listenFd);
+            unlink(path.c_str());
+            return 0;
+        }
+    };
+}
+
+// usage: --serve <socket> [workers]
+static int runServe(std::vector<std::string> const &args)
+{
+    if (args.size() < 2)
+    {
+        std::cerr << "usage: --serve <socket> [workers]" << std::endl;
+        return 1;
+    }
+
+    auto const workers = args.size() > 2 ? std::stoi(args[2])
+                                         : std::max(1, int(std::thread::hardware_concurrency()));
+
+    auto const tiles = createTileRegistry();
+    Service::Server server(tiles.get());
+    return server.run(args[1], workers);
+}
+
+// usage: --client <socket> <seed> <out|-> [format] [terrain-seed] [noise]
+//        --client <socket> <stats|shutdown>
+//        --client <socket> load <requests> [connections]
+static int runClient(std::vector<std::string> const &args)
+{
+    if (args.size() < 3)
+    {
+        std::cerr << "usage: --client <socket> <seed> <out|-> [format] [terrain-seed] [noise]" << std::endl
+                  << "       --client <socket> <stats|shutdown>" << std::endl
+                  << "       --client <socket> load <requests> [connections]" << std::endl;
+        return 1;
+    }
+
+    auto const &path = args[1];
+
+    // sends a request, the payload of a world goes to `out` when given
+    auto const request = [&](Service::Connection &connection, nlohmann::json const &message, Export::FileSink *const out)
+    {
+        std::string line;
+        if (!connection.writeLine(message) || !connection.readLine(line))
+            return nlohmann::json{{"status", "error"}, {"message", "connection lost"}};
+
+        auto response = nlohmann::json::parse(line);
+        if (auto const bytes = response.value("bytes", size_t(0)); bytes > 0)
+        {
+            std::vector<uint8_t> payload(bytes);
+            if (!connection.readBytes(payload.data(), payload.size()) || (out && !out->write(payload.data(), bytes)))
+                return nlohmann::json{{"status", "error"}, {"message", "payload lost"}};
+        }
+
+        return response;
+    };
+
+    if (args[2] == "stats" || args[2] == "shutdown")
     {
-        auto tilePtr = obj->tiles.data();
-        auto obstruction = obstructed + callerX + callerY * WORLD_WIDTH;
+        auto const fd = Service::connectTo(path);
+        if (fd < 0)
+        {
+            std::cerr << "unable to connect to '" << path << "'" << std::endl;
+            return 1;
+        }
 
-        for (int y = 0; y < obj->height; y++, obstruction += WORLD_WIDTH - obj->width)
-            for (int x = 0; x < obj->width; x++, tilePtr++, obstruction++)
-                // is it an actual structure part?
-                if (*tilePtr != STRUCTURE_VOID)
-                    *obstruction = true;
+        Service::Connection connection(fd);
+        std::cout << request(connection, {{args[2], true}}, nullptr).dump(4) << std::endl;
+        close(fd);
+        return 0;
     }
 
-    bool can_be_build(
-        int const callerX,
-        int const callerY,
-        StructureObject const *const obj) const
+    // several connections sending requests back to back, then the server side statistics
+    if (args[2] == "load")
     {
-        if (callerX < 0 || callerX + obj->width > WORLD_WIDTH_M1 ||
-            callerY < 0 || callerY + obj->height > WORLD_HEIGHT_M1)
-            return false;
+        auto const count = args.size() > 3 ? std::stoi(args[3]) : 100;
+        auto const connectionCount = args.size() > 4 ? std::stoi(args[4]) : 4;
+
+        std::atomic<int> next{0};
+        std::atomic<int> failures{0};
+        std::vector<std::thread> threads;
+
+        auto const start = Service::Clock::now();
+        for (int i = 0; i < connectionCount; i++)
+            threads.emplace_back([&]() {
+                auto const fd = Service::connectTo(path);
+                if (fd < 0)
+                {
+                    failures++;
+                    return;
+                }
 
-        auto tilePtr = obj->tiles.data();
-        auto obstruction = obstructed + callerX + callerY * WORLD_WIDTH;
+                Service::Connection connection(fd);
+                for (auto seed = next++; seed < count; seed = next++)
+                    if (request(connection, {{"seed", seed}}, nullptr).value("status", "") != "ok")
+                        failures++;
 
-        for (int y = 0; y < obj->height; y++, obstruction += WORLD_WIDTH - obj->width)
-            for (int x = 0; x < obj->width; x++, tilePtr++, obstruction++)
-                // is this part already occupied by some other structure?
-                if (*tilePtr != STRUCTURE_VOID && *obstruction)
-                    return false;
+                close(fd);
+            });
 
-        return true;
+        for (auto &thread : threads)
+            thread.join();
+
+        auto const seconds = std::chrono::duration<double>(Service::Clock::now() - start).count();
+        std::cout << count << " request(s) in " << seconds << " s, " << failures << " failure(s)" << std::endl;
+
+        auto const fd = Service::connectTo(path);
+        if (fd < 0)
+            return 1;
+
+        Service::Connection connection(fd);
+        std::cout << request(connection, {{"stats", true}}, nullptr).dump(4) << std::endl;
+        close(fd);
+        return failures == 0 ? 0 : 2;
     }
 
-    struct BuildRequest
+    if (args.size() < 4)
     {
-        int x;
-        int y;
-        StructureObject const *obj;
-        int cost;
-    };
+        std::cerr << "usage: --client <socket> <seed> <out|-> [format] [terrain-seed] [noise]" << std::endl;
+        return 1;
+    }
 
-    std::deque<std::unique_ptr<BuildRequest>> buildQueue;
+    auto const fd = Service::connectTo(path);
+    if (fd < 0)
+    {
+        std::cerr << "unable to connect to '" << path << "'" << std::endl;
+        return 1;
+    }
 
-    void build(
-        int const callerX,
-        int const callerY,
-        StructureObject const *const obj,
-        int const cost)
+    Export::FileSink out(args[3]);
+    if (!out.isOpen())
     {
-        auto tilePtr = obj->tiles.data();
+        std::cerr << "unable to open '" << args[3] << "'" << std::endl;
+        close(fd);
+        return 1;
+    }
 
-        // materialize the structure
-        for (int y = 0; y < obj->height; y++)
-        {
-            for (int x = 0; x < obj->width; x++, tilePtr++)
-                // is it an actual structure part?
-                switch (*tilePtr)
-                {
-                case STRUCTURE_VOID:
-                    // just ignore it
-                    break;
+    nlohmann::json message = {{"seed", uint32_t(std::stoul(args[2]))}};
+    if (args.size() > 4)
+        message["format"] = args[4];
+    if (args.size() > 5)
+        message["terrain-seed"] = std::stoi(args[5]);
+    if (args.size() > 6)
+        message["noise"] = args[6];
 
-                case STRUCTURE_JOINT:
-                {
-                    // place replacement tile instead
-                    auto const cIndex = (x << 8) + (obj->height - 1 - y);
-                    auto const &jointName = obj->config.coordToJoint.at(cIndex);
-                    auto const &joint = obj->config.joints.at(jointName);
+    Service::Connection connection(fd);
+    auto const response = request(connection, message, &out);
+    close(fd);
 
-                    world->setTile(callerX + x, callerY + y, tileRegistry->getTile(joint.replaceBy));
-                    break;
-                }
+    std::cerr << response.dump() << std::endl;
+    return response.value("status", "") == "ok" ? 0 : 1;
+}
+#endif
 
-                default:
-                    world->setTile(callerX + x, callerY + y, *tilePtr);
-                    break;
-                }
-        }
+#ifdef WORLDGEN_PROFILING
+// usage: --profile <trace.json> [seed] [runs]
+// with several runs the caches get warm and only the last one is reported
+static int runProfile(std::vector<std::string> const &args)
+{
+    if (args.size() < 2)
+    {
+        std::cerr << "usage: --profile <trace.json> [seed] [runs]" << std::endl;
+        return 1;
     }
 
-    void propagate(
-        int const callerX,
-        int const callerY,
-        StructureObject const *const obj,
-        int const cost)
+    auto const seed = args.size() > 2 ? uint32_t(std::stoul(args[2])) : 0u;
+    auto const runs = args.size() > 3 ? std::stoi(args[3]) : 1;
+
+    auto const tiles = createTileRegistry();
+    auto const world = std::make_unique<World>();
+    auto const gen = std::make_unique<WorldGenerator>();
+    for (int i = 0; i < runs; i++)
     {
-        std::vector<Configuration::Structure::Target const *> targets;
+        world->clear();
+        gen->generate(world.get(), tiles.get(), seed);
+    }
 
-        for (auto const &[_, joint] : obj->config.joints)
-            if (joint.structures.size() > 0)
-            {
-                // queue the following structure (structure-specific alignment will be done separately)
-                auto const newX = callerX + joint.direction[0] + joint.location[0];
-                auto const newY = callerY + joint.direction[1] + (obj->height - 1 - joint.location[1]);
+    auto const &profiler = Profiling::Profiler::instance();
+    for (auto const &[name, stat] : profiler.getStats())
+        std::cout << name << ": " << stat.totalNs / 1e6 << " ms in " << stat.calls << " call(s)" << std::endl;
+    for (auto const &[name, value] : profiler.getCounters())
+        std::cout << name << ": " << value << std::endl;
 
-                // prepare the pool of target structures
-                targets.clear();
-                uint32_t totalWeight = 0;
-                for (auto const &target : joint.structures)
-                {
-                    targets.emplace_back(&target);
-                    totalWeight += target.weight;
-                }
+    std::ofstream out(args[1]);
+    profiler.writeChromeTrace(out);
+    return out ? 0 : 1;
+}
 
-                // enqueue the random placeable target
-                while (!targets.empty())
-                {
-                    Configuration::Structure::Target const *target = nullptr;
+static void drawProfilerOverlay()
+{
+    auto const &profiler = Profiling::Profiler::instance();
+    auto const stats = profiler.getStats();
+    auto const counters = profiler.getCounters();
 
-                    if (totalWeight == 0 || targets.size() == 1)
-                    {
-                        // pick the only thing left
-                        target = *targets.begin();
-                        targets.clear();
-                    }
-                    else
-                    {
-                        // pick a random value
-                        auto const value = rand() % totalWeight;
+    constexpr int FONT_SIZE = 10;
+    constexpr int LINE_HEIGHT = FONT_SIZE + 2;
 
-                        // find anything that is above the threshold
-                        auto weightSum = 0;
-                        for (auto it = targets.cbegin(); it != targets.cend(); it++)
-                        {
-                            auto const candidate = *it;
-                            weightSum += candidate->weight;
+    auto const lines = int(stats.size() + counters.size());
+    DrawRectangle(4, 4, 330, 8 + lines * LINE_HEIGHT, Fade(BLACK, 0.75f));
 
-                            if (weightSum > value)
-                            {
-                                target = candidate;
+    int y = 8;
+    for (auto const &[name, stat] : stats)
+    {
+        DrawText(TextFormat("%-40s %8.2f ms %6lld", name.c_str(), stat.totalNs / 1e6, (long long)stat.calls),
+                 8, y, FONT_SIZE, RAYWHITE);
+        y += LINE_HEIGHT;
+    }
 
-                                // remove the selected thing from the pool unrelated to placement successfulness
-                                targets.erase(it);
-                                totalWeight -= target->weight;
+    for (auto const &[name, value] : counters)
+    {
+        DrawText(TextFormat("%-40s %lld", name.c_str(), (long long)value), 8, y, FONT_SIZE, YELLOW);
+        y += LINE_HEIGHT;
+    }
+}
+#endif
 
-                                break;
-                            }
-                        }
-                    }
+// ========================================================================
 
-                    // attempt to place the thing
-                    if (requestStructureAt(newX, newY, target->structureId, target->joint, cost))
-                        break;
-                }
-            }
-    }
+// downsampled copies of the tile map, each level halves both sizes; a 2x2 block keeps its most
+// important tile, so thin structures stay visible when zoomed out
+class TilePyramid
+{
+private:
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<TileId> tiles; // bottom to top like World
+    };
 
-    std::unordered_map<std::string, StructurePlacementChecker> placementCheckers;
+    std::vector<Level> levels;
+
+    // dirty rectangle of level 0, [minX; maxX) x [minY; maxY)
+    int dirtyMinX = 0;
+    int dirtyMinY = 0;
+    int dirtyMaxX = WORLD_WIDTH;
+    int dirtyMaxY = WORLD_HEIGHT;
+
+    static int priority(TileId const tile)
+    {
+        switch (tile)
+        {
+        case AIR:
+            return 0;
+        case SOIL:
+            return 1;
+        case STONE:
+            return 2;
+        default:
+            return 3;
+        }
+    }
 
 public:
-    StructureBuilder()
+    TilePyramid()
     {
-        this->placementCheckers.emplace("underground", undergroundPlacementChecker);
-        this->placementCheckers.emplace("no-blocks", noBlocksPlacementChecker);
+        for (int width = WORLD_WIDTH, height = WORLD_HEIGHT;; width = (width + 1) / 2, height = (height + 1) / 2)
+        {
+            levels.push_back({width, height, std::vector<TileId>(size_t(width) * height, AIR)});
+            if (width == 1 && height == 1)
+                break;
+        }
     }
 
-    void attachWorld(World *const worldPtr)
+    int getLevelCount() const
     {
-        this->world = worldPtr;
+        return int(levels.size());
     }
 
-    void attachStructureProvider(StructureProvider *const provider)
+    void markDirty(int const minX, int const minY, int const maxX, int const maxY)
     {
-        this->structureProvider = provider;
+        dirtyMinX = std::min(dirtyMinX, std::max(minX, 0));
+        dirtyMinY = std::min(dirtyMinY, std::max(minY, 0));
+        dirtyMaxX = std::max(dirtyMaxX, std::min(maxX, WORLD_WIDTH));
+        dirtyMaxY = std::max(dirtyMaxY, std::min(maxY, WORLD_HEIGHT));
     }
 
-    void attachTileRegistry(TileRegistry const *registry)
+    bool isDirty() const
     {
-        this->tileRegistry = registry;
+        return dirtyMinX < dirtyMaxX && dirtyMinY < dirtyMaxY;
     }
 
-    void reset()
+    // brings the dirty rectangle up to date from the world, on every level
+    void update(World const *const world)
     {
-        std::fill(std::begin(obstructed), std::end(obstructed), false);
+        if (!isDirty())
+            return;
+
+        auto &base = levels[0];
+        world->readRegion(
+            dirtyMinX, dirtyMinY, dirtyMaxX - dirtyMinX, dirtyMaxY - dirtyMinY,
+            base.tiles.data() + dirtyMinX + dirtyMinY * base.width, base.width);
+
+        auto minX = dirtyMinX, minY = dirtyMinY, maxX = dirtyMaxX, maxY = dirtyMaxY;
+        for (size_t i = 1; i < levels.size(); i++)
+        {
+            auto const &src = levels[i - 1];
+            auto &dst = levels[i];
+
+            minX /= 2;
+            minY /= 2;
+            maxX = (maxX + 1) / 2;
+            maxY = (maxY + 1) / 2;
+
+            for (int y = minY; y < maxY; y++)
+                for (int x = minX; x < maxX; x++)
+                {
+                    auto best = AIR;
+                    for (int dy = 0; dy < 2; dy++)
+                        for (int dx = 0; dx < 2; dx++)
+                        {
+                            auto const sx = std::min(x * 2 + dx, src.width - 1);
+                            auto const sy = std::min(y * 2 + dy, src.height - 1);
+                            auto const tile = src.tiles[sx + sy * src.width];
+                            if (priority(tile) > priority(best))
+                                best = tile;
+                        }
+
+                    dst.tiles[x + y * dst.width] = best;
+                }
+        }
+
+        dirtyMinX = WORLD_WIDTH;
+        dirtyMinY = WORLD_HEIGHT;
+        dirtyMaxX = 0;
+        dirtyMaxY = 0;
     }
 
-    bool requestStructureAt(
-        int x,
-        int y,
-        std::string const &structureId,
-        std::string const &targetJoint,
-        int cost)
+    // the tile at level 0 coordinates, looked up on the given level
+    TileId getTileAt(int const level, int const x, int const y) const
     {
-        // find the structure and correct the origin point
-        auto const obj = structureProvider->getStructure(structureId);
-        auto const &joint = obj->config.joints.at(targetJoint);
-        x -= joint.location[0];
-        y -= obj->height - 1 - joint.location[1];
+        auto const &l = levels[level];
+        return l.tiles[(x >> level) + (y >> level) * l.width];
+    }
+};
 
-        // correct the cost of current building branch
-        cost += obj->config.cost;
-        if (cost > COST_MAX)
-            return false;
+// the visible part of the world: pan and zoom, only the tiles on screen are converted
+class WorldView
+{
+private:
+    float zoom = 1.f; // screen pixels per tile
+    Vector2 origin = {0.f, 0.f}; // world position of the top left screen corner, y goes down
+    bool changed = true;
+    Color palette[256];
 
-        // see if there is enougth space
-        if (!can_be_build(x, y, obj))
-            return false;
+public:
+    explicit WorldView(TileRegistry const *const registry)
+    {
+        for (int i = 0; i < 256; i++)
+            palette[i] = registry->getTileColor(TileId(i));
+    }
 
-        // check placement constraints
-        for (auto const &constraint : obj->config.placementConstraints)
-            if (auto const &checker = placementCheckers.at(constraint); !checker(world, x, y, obj))
-                return false;
+    void pan(float const dx, float const dy)
+    {
+        origin.x -= dx / zoom;
+        origin.y -= dy / zoom;
+        changed = true;
+    }
 
-        // queue and claim space for it
-        auto req = std::make_unique<BuildRequest>();
-        req->x = x;
-        req->y = y;
-        req->obj = obj;
-        req->cost = cost;
-        buildQueue.emplace_back(std::move(req));
-        claimStructureSpace(x, y, obj);
+    // keeps the world position under the screen point in place
+    void zoomAt(Vector2 const point, float const factor)
+    {
+        auto const newZoom = std::clamp(zoom * factor, 1.f / 64, 32.f);
+        origin.x += point.x / zoom - point.x / newZoom;
+        origin.y += point.y / zoom - point.y / newZoom;
+        zoom = newZoom;
+        changed = true;
+    }
 
-        return true;
+    void invalidate()
+    {
+        changed = true;
     }
 
-    void processAllRequests()
+    // fills the screen sized image, returns false when nothing changed
+    bool render(TilePyramid const &pyramid, Image *const img)
     {
-        while (!buildQueue.empty())
+        if (!changed)
+            return false;
+        changed = false;
+
+        // one level sample per screen pixel at most
+        auto level = 0;
+        while (level + 1 < pyramid.getLevelCount() && zoom * float(1 << (level + 1)) <= 1.f)
+            level++;
+
+        auto pixel = (Color *)img->data;
+        for (int sy = 0; sy < img->height; sy++)
         {
-            auto request = std::move(buildQueue.front());
-            buildQueue.pop_front();
+            auto const ty = int(std::floor(origin.y + sy / zoom));
+            auto const y = WORLD_HEIGHT_M1 - ty;
 
-            // materialize the thing and propagate ongoing structures further after its joints
-            build(request->x, request->y, request->obj, request->cost);
-            propagate(request->x, request->y, request->obj, request->cost);
+            for (int sx = 0; sx < img->width; sx++, pixel++)
+            {
+                auto const x = int(std::floor(origin.x + sx / zoom));
+                if (x < 0 || x > WORLD_WIDTH_M1 || y < 0 || y > WORLD_HEIGHT_M1)
+                    *pixel = BLACK;
+                else
+                    *pixel = palette[pyramid.getTileAt(level, x, y)];
+            }
         }
+
+        return true;
     }
 };
 
 // ========================================================================
 
-class WorldGenerator
+// runs the generation on a worker thread into a back buffer, the viewer swaps it in once finished
+class AsyncGenerator
 {
 private:
-    float fractalNoise(int octaves, float x, float y = 0, float z = 0)
-    {
-        auto result = 0.f;
-        auto scale = 1.0f;
-        auto k = 0.5f;
+    TileRegistry const *tileRegistry;
+    std::unique_ptr<World> back = std::make_unique<World>();
+    std::unique_ptr<World> preview = std::make_unique<World>();
+    std::unique_ptr<WorldGenerator> generator = std::make_unique<WorldGenerator>();
+    GenerationProgress progress;
+    std::atomic<bool> finished{false};
+    std::thread worker;
 
-        for (int i = 0; i < octaves; i++)
-        {
-            scale *= 0.5f;
-            k *= 2.f;
+public:
+    explicit AsyncGenerator(TileRegistry const *const registry) : tileRegistry(registry)
+    {
+        progress.preview = preview.get();
+        generator->attachProgress(&progress);
+    }
 
-            result += scale * (noise3(x * k, y * k, z * k) + 1.0f) * 0.5f;
-        }
+    AsyncGenerator(AsyncGenerator const &) = delete;
+    AsyncGenerator &operator=(AsyncGenerator const &) = delete;
 
-        return result;
+    ~AsyncGenerator()
+    {
+        cancel();
     }
 
-    void genSoil(World *const world)
+    // cancels the generation in flight, if any
+    void start(uint32_t const seed)
     {
-        auto const z = 1; // rand() % 256;
-
-        for (int y = 0; y < WORLD_HEIGHT; y++)
-            for (int x = 0; x < WORLD_WIDTH; x++)
-            {
-                auto const n1 = fractalNoise(3, x / 128.f, z);
-                auto const n2 = fractalNoise(3, x / 64.f, y / 64.f, z) * (WORLD_HEIGHT - y) / WORLD_HEIGHT;
-                auto const n3 = fractalNoise(2, x / 32.f, y / 16.f, z + 1.f);
+        cancel();
 
-                if (n3 > 0.385 * 0.85)
-                {
-                    if (y < n1 * WORLD_HEIGHT)
-                        world->setTile(x, y, SOIL);
+        progress.reset();
+        finished = false;
 
-                    if (n2 > 0.3f)
-                        world->setTile(x, y, STONE);
-                }
-                /*if (y < (WORLD_HEIGHT >> 1))
-                    world->setTile(x, y, STONE);*/
-            }
+        worker = std::thread([this, seed]() {
+            back->clear();
+            generator->generate(back.get(), tileRegistry, seed);
+            finished.store(true, std::memory_order_release);
+        });
     }
 
-    StructureProvider provider;
-    StructureBuilder builder;
+    void cancel()
+    {
+        if (!worker.joinable())
+            return;
+
+        progress.cancelled = true;
+        worker.join();
+    }
 
-    void genBase(World *const world)
+    bool isRunning() const
     {
-        int const startX = 15 + rand() % (WORLD_WIDTH_M1 - 15 * 2);
-        int const startY = world->getHeightAt(startX) - 2;
+        return worker.joinable();
+    }
 
-        builder.requestStructureAt(startX, startY, "room/base", "#floor", 0);
-        builder.processAllRequests();
+    // the preview rows [0; getFinishedRows()) hold the terrain and can be read while the worker is running,
+    // the back buffer itself belongs to the worker until tryFinish()
+    int getFinishedRows() const
+    {
+        return progress.getPreviewRows();
     }
 
-public:
-    void generate(World *const world, TileRegistry const *const tileRegistry)
+    World const *getPreview() const
     {
-        provider.attachTileRegistry(tileRegistry);
+        return preview.get();
+    }
 
-        builder.reset();
-        builder.attachTileRegistry(tileRegistry);
-        builder.attachStructureProvider(&provider);
-        builder.attachWorld(world);
+    // swaps the generated world with `front` once the worker is done
+    bool tryFinish(std::unique_ptr<World> &front)
+    {
+        if (!worker.joinable() || !finished.load(std::memory_order_acquire))
+            return false;
 
-        genSoil(world);
-        genBase(world);
+        worker.join();
+        std::swap(front, back);
+        return true;
     }
 };
 
 // ========================================================================
 
-int main(void)
+int main(int argc, char **argv)
 {
+    std::vector<std::string> const args(argv + 1, argv + argc);
+
+    // headless modes
+    if (!args.empty() && args[0] == "--export")
+        return runExport(args);
+    if (!args.empty() && args[0] == "--export-check")
+        return runExportCheck(args);
+    if (!args.empty() && (args[0] == "--bench" || args[0] == "--bench-compare"))
+        return runBenchmarks(args);
+    if (!args.empty() && args[0] == "--golden")
+        return runGolden(args);
+    if (!args.empty() && args[0] == "--pipeline")
+        return runPipeline(args);
+    if (!args.empty() && args[0] == "--stress")
+        return runStress(args);
+    if (!args.empty() && args[0] == "--check-assets")
+        return runCheckAssets(args);
+#ifndef _WIN32
+    if (!args.empty() && args[0] == "--serve")
+        return runServe(args);
+    if (!args.empty() && args[0] == "--client")
+        return runClient(args);
+#endif
+#ifdef WORLDGEN_PROFILING
+    if (!args.empty() && args[0] == "--profile")
+        return runProfile(args);
+#endif
+
     // Initialization
     //--------------------------------------------------------------------------------------
     const int screenWidth = 1000;
@@ -631,46 +6504,80 @@ int main(void)
     InitWindow(screenWidth, screenHeight, "2D Worldgen Testing Ground");
     SetTargetFPS(20);
 
-    auto const tiles = std::make_unique<TileRegistry>();
-    tiles->registerTile(AIR, "blocks/air", BLACK);
-    tiles->registerTile(SOIL, "blocks/soil", DARKPURPLE);
-    tiles->registerTile(STONE, "blocks/stone", DARKBLUE);
-    tiles->registerTile(BACKGROUND, "blocks/background", DARKGRAY);
-    tiles->registerTile(WALL, "blocks/wall", LIGHTGRAY);
-    tiles->registerTile(CHAIN, "blocks/chain", LIME);
+    auto const tiles = createTileRegistry();
 
-    tiles->registerTile(STRUCTURE_VOID, "structure/void", RED);
-    tiles->registerTile(STRUCTURE_JOINT, "structure/joint", RED);
+    auto world = std::make_unique<World>();
+    AsyncGenerator gen(tiles.get());
+    auto shownRows = 0;
 
-    auto const world = std::make_unique<World>();
-    auto const gen = std::make_unique<WorldGenerator>();
+    // the texture has the size of the screen, not of the world
+    auto imgView = GenImageColor(screenWidth, screenHeight, BLACK);
+    auto texView = LoadTextureFromImage(imgView);
+    Vector2 posView = {0};
+
+    TilePyramid pyramid;
+    WorldView view(tiles.get());
 
-    auto imgWorld = GenImageColor(WORLD_WIDTH, WORLD_HEIGHT, BLACK);
-    auto texWorld = LoadTextureFromImage(imgWorld);
-    Vector2 posWorld = {0};
+    // a clean pyramid, later only the streamed rows are read from the preview
+    pyramid.update(world.get());
 
     Vector2 ballPosition = {-100.0f, -100.0f};
-    auto scale = 1.f;
+    auto showProfiler = false;
+    auto seed = std::random_device{}();
 
     // Main loop
     while (!WindowShouldClose())
     {
         // Update
         //----------------------------------------------------------------------------------
-        ballPosition = GetMousePosition();
-        scale += 0.5f * GetMouseWheelMove();
-
-        IsMouseButtonDown(MouseButton::MOUSE_LEFT_BUTTON);
-
+        // mouse wheel - zoom, right button - pan
+        auto const mouse = GetMousePosition();
+        if (auto const wheel = GetMouseWheelMove(); wheel != 0.f)
+            view.zoomAt(mouse, std::pow(2.f, 0.5f * wheel));
+        if (IsMouseButtonDown(MouseButton::MOUSE_RIGHT_BUTTON))
+            view.pan(mouse.x - ballPosition.x, mouse.y - ballPosition.y);
+        ballPosition = mouse;
+
+        // the generation runs in the background, pressing SPACE again restarts it
         if (IsKeyPressed(KeyboardKey::KEY_SPACE))
         {
-            world->clear();
+            gen.start(seed++);
+            shownRows = 0;
+        }
+
+        if (gen.tryFinish(world))
+        {
+            pyramid.markDirty(0, 0, WORLD_WIDTH, WORLD_HEIGHT);
+            pyramid.update(world.get());
+            view.invalidate();
+        }
+        else if (gen.isRunning())
+        {
+            // stream the finished terrain rows meanwhile
+            auto const finishedRows = gen.getFinishedRows();
+            if (finishedRows > shownRows)
+            {
+                pyramid.markDirty(0, shownRows, WORLD_WIDTH, finishedRows);
+                pyramid.update(gen.getPreview());
+                view.invalidate();
+                shownRows = finishedRows;
+            }
+        }
+
+        if (view.render(pyramid, &imgView))
+            UpdateTexture(texView, imgView.data);
 
-            gen->generate(world.get(), tiles.get());
-            world->render(&imgWorld, tiles.get());
+        // F1 - toggle the profiler overlay, F2 - save the last generation as a chrome trace
+        if (IsKeyPressed(KeyboardKey::KEY_F1))
+            showProfiler = !showProfiler;
 
-            UpdateTexture(texWorld, imgWorld.data);
+#ifdef WORLDGEN_PROFILING
+        if (IsKeyPressed(KeyboardKey::KEY_F2))
+        {
+            std::ofstream out("worldgen-trace.json");
+            Profiling::Profiler::instance().writeChromeTrace(out);
         }
+#endif
 
         //----------------------------------------------------------------------------------
 
@@ -680,15 +6587,21 @@ int main(void)
 
         ClearBackground(BLACK);
 
-        DrawTextureEx(texWorld, posWorld, 0.f, scale, WHITE);
+        DrawTextureEx(texView, posView, 0.f, 1.f, WHITE);
+
+#ifdef WORLDGEN_PROFILING
+        if (showProfiler)
+            drawProfilerOverlay();
+#endif
 
         EndDrawing();
         //----------------------------------------------------------------------------------
     }
 
     // De-Initialization
-    UnloadTexture(texWorld);
-    UnloadImage(imgWorld);
+    gen.cancel();
+    UnloadTexture(texView);
+    UnloadImage(imgView);
     CloseWindow();
 
     return 0;